@@ -0,0 +1,124 @@
+/*
+ * cache.c
+ *
+ * Copyright (C)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * About
+ * -----
+ *
+ * Author: AiO <aio at aio dot nu>
+ *
+ * Simple implementation of receiver state caches. The caches follow a
+ * small header in one mapping, anonymous or of the state file, and are
+ * written to in place, the kernel writes a file back when it sees fit.
+ *
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "error.h"
+#include "debug.h"
+#include "cache.h"
+
+/*
+ * The header is padded so that the caches start aligned.
+ */
+#define CACHE_HEADER_SIZE 64
+
+#define CACHE_SIZE(n) (CACHE_HEADER_SIZE + (n) * sizeof(m2m_cache))
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t cache_size;
+  uint32_t ncaches;
+} cache_header;
+
+static const char cache_magic[8] = "M2MSTA\n";
+
+
+m2m_cache *cache_new(const char *filename, int ncaches) {
+  cache_header *header;
+  m2m_cache *caches;
+  struct stat st;
+  void *p;
+  int fd = -1;
+  int i;
+
+  if (NULL == filename) {
+    p = mmap(NULL, CACHE_SIZE(ncaches), PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  }
+  else {
+    if ((fd = open(filename, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) < 0) {
+      error("Could not open the state file '%s' (errno %d).",
+            filename, errno);
+    }
+    if ((0 != fstat(fd, &st)) ||
+        ((CACHE_SIZE(ncaches) != (size_t)st.st_size) &&
+         (0 != ftruncate(fd, CACHE_SIZE(ncaches))))) {
+      error("Could not size the state file '%s' (errno %d).",
+            filename, errno);
+    }
+    p = mmap(NULL, CACHE_SIZE(ncaches), PROT_READ | PROT_WRITE,
+             MAP_SHARED, fd, 0);
+    close(fd);
+  }
+
+  if (MAP_FAILED == p) {
+    error("Could not map %d receiver state caches (errno %d).",
+          ncaches, errno);
+  }
+
+  header = (cache_header *)p;
+  caches = (m2m_cache *)((char *)p + CACHE_HEADER_SIZE);
+
+  if ((0 != memcmp(header->magic, cache_magic, sizeof(cache_magic))) ||
+      (CACHE_VERSION != header->version) ||
+      (sizeof(m2m_cache) != header->cache_size) ||
+      ((uint32_t)ncaches != header->ncaches)) {
+    if (NULL != filename) {
+      debug("Starting over with the state file '%s'", filename);
+    }
+    for (i = 0; i < ncaches; i++) {
+      m2m_cache_init(&caches[i]);
+    }
+    header->version = CACHE_VERSION;
+    header->cache_size = sizeof(m2m_cache);
+    header->ncaches = ncaches;
+    memcpy(header->magic, cache_magic, sizeof(cache_magic));
+  }
+
+  return caches;
+}
+
+
+void cache_delete(m2m_cache *caches, int ncaches) {
+  if (NULL == caches) {
+    return;
+  }
+
+  munmap((char *)caches - CACHE_HEADER_SIZE, CACHE_SIZE(ncaches));
+}
@@ -0,0 +1,55 @@
+/*
+ * cache.h
+ *
+ * Copyright (C)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * About
+ * -----
+ *
+ * Author: AiO <aio at aio dot nu>
+ *
+ * Simple API for the receiver state caches of all output ports. They are
+ * kept in memory, or in a shared mapping of a file so that what the
+ * receivers were sent is still known after a restart.
+ *
+ */
+
+#ifndef _CACHE_H_
+#define _CACHE_H_
+
+#include "m2m.h"
+
+/*
+ * Version of the state file format, files of any other version are reset.
+ */
+#define CACHE_VERSION 1
+
+
+/*
+ * Allocate ncaches receiver state caches, in the file filename or in
+ * memory if it is NULL. A file that does not exist, or that holds another
+ * number or version of caches, starts with caches that know nothing.
+ */
+m2m_cache *cache_new(const char *filename, int ncaches);
+
+
+/*
+ * Cleanup the caches, what is in a file stays there.
+ */
+void cache_delete(m2m_cache *caches, int ncaches);
+
+#endif /* _CACHE_H_ */
@@ -0,0 +1,778 @@
+/*
+ * config.c
+ *
+ * Copyright (C)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * About
+ * -----
+ *
+ * Author: AiO <aio at aio dot nu>
+ *
+ * Reading of midi2midi configuration files into translation rule sets.
+ * Nothing in here exits the program, so that a broken file can be
+ * reported and the old rules kept when reloading a running instance.
+ *
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "error.h"
+#include "debug.h"
+#include "m2m.h"
+#include "config.h"
+#include "image.h"
+#ifdef USE_JACK
+#include "jack_transport.h"
+#endif
+
+/*
+ * Largest number accepted anywhere in a configuration file, anything
+ * larger is out of range for every field anyway.
+ */
+#define CONFIG_NUMBER_MAX 9999
+
+/*
+ * Type definition for reading a configuration file in one pass, straight
+ * from its memory mapping. The buffer is not null-terminated, so nothing
+ * may be read at or beyond end.
+ */
+typedef struct {
+  const char *filename;
+  const char *p;
+  const char *end;
+  const char *line_start;
+  int line_number;
+  char *message;
+} config_scanner;
+
+
+/*
+ * Format an error message and return -1.
+ */
+static int config_fail(char *message, const char *format, ...) {
+  va_list args;
+
+  va_start(args, format);
+  vsnprintf(message, CONFIG_MESSAGE_SIZE, format, args);
+  va_end(args);
+
+  return -1;
+}
+
+
+/*
+ * Format an error message about the position at in the current line,
+ * prefixed with the file name, line and column, and return -1.
+ */
+static int config_error(config_scanner *s,
+                        const char *at,
+                        const char *format, ...) {
+  va_list args;
+  int len;
+
+  len = snprintf(s->message, CONFIG_MESSAGE_SIZE, "%s:%d:%d: ", s->filename,
+                 s->line_number, (int)(at - s->line_start) + 1);
+  if ((0 > len) || (CONFIG_MESSAGE_SIZE <= len)) {
+    return -1;
+  }
+
+  va_start(args, format);
+  vsnprintf(s->message + len, CONFIG_MESSAGE_SIZE - len, format, args);
+  va_end(args);
+
+  return -1;
+}
+
+
+static int config_at_eol(const config_scanner *s) {
+  return (s->p == s->end) || ('\n' == *s->p) || ('\r' == *s->p);
+}
+
+
+static void config_skip_blanks(config_scanner *s) {
+  while ((s->p != s->end) && ((' ' == *s->p) || ('\t' == *s->p))) {
+    s->p++;
+  }
+}
+
+
+/*
+ * Move on to the start of the next line.
+ */
+static void config_next_line(config_scanner *s) {
+  while ((s->p != s->end) && ('\n' != *s->p)) {
+    s->p++;
+  }
+  if (s->p != s->end) {
+    s->p++;
+  }
+  s->line_start = s->p;
+  s->line_number++;
+}
+
+
+/*
+ * Read an unsigned decimal number.
+ */
+static int config_number(config_scanner *s, int *value) {
+  const char *start = s->p;
+
+  *value = 0;
+  while ((s->p != s->end) && ('0' <= *s->p) && ('9' >= *s->p)) {
+    *value = *value * 10 + (*s->p - '0');
+    s->p++;
+    if (CONFIG_NUMBER_MAX < *value) {
+      return config_error(s, start, "Number is too large.");
+    }
+  }
+
+  if (start == s->p) {
+    if (config_at_eol(s)) {
+      return config_error(s, s->p, "Expected a number at the end of the "
+                          "line.");
+    }
+    return config_error(s, s->p, "Expected a number, not '%c'.", *s->p);
+  }
+
+  return 0;
+}
+
+
+/*
+ * Read a velocity curve after a '~' into a table for every velocity: exp
+ * or log, a fixed velocity, or a range velocities 1-127 are compressed
+ * into. The curve is computed once here, translating is a table lookup.
+ */
+static int config_curve(config_scanner *s, unsigned char curve[128]) {
+  const char *at = s->p;
+  int low, high, v;
+
+  curve[0] = 0;
+
+  if ((s->end - s->p >= 3) && (0 == memcmp(s->p, "exp", 3))) {
+    s->p += 3;
+    for (v = 1; v < 128; v++) {
+      int c = (v * v + 63) / 127;
+      curve[v] = (0 < c) ? c : 1;
+    }
+    return 0;
+  }
+
+  if ((s->end - s->p >= 3) && (0 == memcmp(s->p, "log", 3))) {
+    s->p += 3;
+    for (v = 1; v < 128; v++) {
+      int square = v * 127;
+      int c = 1;
+      while ((c + 1) * (c + 1) <= square) {
+        c++;
+      }
+      if ((c + 1) * (c + 1) - square < square - c * c) {
+        c++;
+      }
+      curve[v] = c;
+    }
+    return 0;
+  }
+
+  if (0 != config_number(s, &low)) {
+    return config_error(s, at, "Expected a velocity curve, exp, log, a "
+                        "velocity or a velocity range.");
+  }
+  high = low;
+  if ((s->p != s->end) && ('-' == *s->p)) {
+    s->p++;
+    if (0 != config_number(s, &high)) {
+      return -1;
+    }
+  }
+  if ((1 > low) || (low > high) || (127 < high)) {
+    return config_error(s, at, "Velocities must be between 1 and 127, "
+                        "lowest first.");
+  }
+  for (v = 1; v < 128; v++) {
+    curve[v] = low + ((v - 1) * (high - low) + 63) / 126;
+  }
+
+  return 0;
+}
+
+
+/*
+ * Parse one translation line and add it to the rule set. A line can start
+ * with the source channel the rule applies to followed by a '/', otherwise
+ * it applies to all channels, and end with the output channel after a ','.
+ * Notes can be followed by the velocities the line applies to after a '@',
+ * and the line by a velocity curve after a '~'. Blanks are allowed between
+ * all parts.
+ */
+#ifdef USE_JACK
+static int config_line(config_scanner *s,
+                       m2m_rules *rules,
+                       capability *capabilities,
+                       int use_jack) {
+#else
+static int config_line(config_scanner *s,
+                       m2m_rules *rules,
+                       capability *capabilities) {
+#endif
+  int from, last, to, channel = 0;
+  int source_channel = -1;
+  int relative = 0;
+  int low = 1, high = 127;
+  int layered = 0, curved = 0;
+  unsigned char curve[128];
+  const char *from_at, *to_at, *channel_at = NULL, *separator_at;
+  const char *velocity_at = NULL;
+  translation_type type = TT_NONE;
+  char c;
+
+  from_at = s->p;
+  if (0 != config_number(s, &from)) {
+    return -1;
+  }
+  config_skip_blanks(s);
+
+  if ((s->p != s->end) && ('/' == *s->p)) {
+    source_channel = from;
+    if ((16 < source_channel) || (1 > source_channel)) {
+      return config_error(s, from_at, "Source channel must be between 1 and "
+                          "16, not %d.", source_channel);
+    }
+    s->p++;
+    config_skip_blanks(s);
+    from_at = s->p;
+    if (0 != config_number(s, &from)) {
+      return -1;
+    }
+    config_skip_blanks(s);
+  }
+
+  /*
+   * A range of values, from-last, shares one translation.
+   */
+  last = from;
+  if ((s->p != s->end) && ('-' == *s->p)) {
+    const char *last_at;
+    s->p++;
+    config_skip_blanks(s);
+    last_at = s->p;
+    if (0 != config_number(s, &last)) {
+      return -1;
+    }
+    if (last < from) {
+      return config_error(s, last_at, "The range %d-%d is empty.", from,
+                          last);
+    }
+    config_skip_blanks(s);
+  }
+
+  /*
+   * A velocity layer, @low-high or @velocity.
+   */
+  if ((s->p != s->end) && ('@' == *s->p)) {
+    s->p++;
+    config_skip_blanks(s);
+    velocity_at = s->p;
+    if (0 != config_number(s, &low)) {
+      return -1;
+    }
+    high = low;
+    config_skip_blanks(s);
+    if ((s->p != s->end) && ('-' == *s->p)) {
+      s->p++;
+      config_skip_blanks(s);
+      if (0 != config_number(s, &high)) {
+        return -1;
+      }
+      config_skip_blanks(s);
+    }
+    if ((1 > low) || (low > high) || (127 < high)) {
+      return config_error(s, velocity_at, "Velocities must be between 1 and "
+                          "127, lowest first.");
+    }
+    layered = 1;
+  }
+
+  if (config_at_eol(s)) {
+    return config_error(s, s->p, "Expected a separator at the end of the "
+                        "line.");
+  }
+  separator_at = s->p;
+  c = *s->p++;
+  config_skip_blanks(s);
+
+  /*
+   * A signed to value transposes by that much, an unsigned one is what the
+   * first value of a range is translated to.
+   */
+  to_at = s->p;
+  if ((s->p != s->end) && (('+' == *s->p) || ('-' == *s->p))) {
+    relative = ('+' == *s->p) ? 1 : -1;
+    s->p++;
+  }
+  if (0 != config_number(s, &to)) {
+    return -1;
+  }
+  if (0 == relative) {
+    to -= from;
+  }
+  else {
+    to *= relative;
+  }
+  config_skip_blanks(s);
+
+  if ((s->p != s->end) && (',' == *s->p)) {
+    s->p++;
+    config_skip_blanks(s);
+    channel_at = s->p;
+    if (0 != config_number(s, &channel)) {
+      return -1;
+    }
+    if ('M' == c) {
+      if (127 < channel) {
+        return config_error(s, channel_at, "Device ID must be between 0 "
+                            "and 127, not %d.", channel);
+      }
+    }
+    else if (16 < channel) {
+      return config_error(s, channel_at, "Channel number must be between 1 "
+                          "and 16, not %d.", channel);
+    }
+    config_skip_blanks(s);
+  }
+
+  if ((s->p != s->end) && ('~' == *s->p)) {
+    s->p++;
+    config_skip_blanks(s);
+    if (0 != config_curve(s, curve)) {
+      return -1;
+    }
+    curved = 1;
+    config_skip_blanks(s);
+  }
+
+  if (!config_at_eol(s)) {
+    return config_error(s, s->p, "Unexpected '%c' after the translation.",
+                        *s->p);
+  }
+
+  debug("Reading line %d '%d/%d-%d%c%+d,%d'",
+        s->line_number, source_channel, from, last, c, to, channel);
+
+  /*
+   * Valid separators are '>' for CC and ':' for notes.
+   */
+  switch (c) {
+    case '>': {
+      type = TT_CC_TO_CC;
+      *capabilities |= (CB_ALSA_MIDI_IN | CB_ALSA_MIDI_OUT);
+      break;
+    }
+    case ':': {
+      type = TT_NOTE_TO_NOTE;
+      *capabilities |= (CB_ALSA_MIDI_IN | CB_ALSA_MIDI_OUT);
+      break;
+    }
+    case '!': {
+      type = TT_NOTE_TO_CC;
+      *capabilities |= (CB_ALSA_MIDI_IN | CB_ALSA_MIDI_OUT);
+      break;
+    }
+    case '?': {
+      type = TT_CC_TO_NOTE;
+      *capabilities |= (CB_ALSA_MIDI_IN | CB_ALSA_MIDI_OUT);
+      break;
+    }
+#ifdef USE_JACK
+    case 'J': {
+      if (0 == use_jack) {
+        warning("Jack features are not enabled, line %d is ignored. Use "
+                "-j, --jack to enable them.", s->line_number);
+      }
+      type = TT_NOTE_TO_JACK;
+      *capabilities |= (CB_ALSA_MIDI_IN | CB_JACK_TRANSPORT_OUT);
+
+      /*
+       * Hard wire translate all the possible jack translation values
+       * and make them as similar as possible to MIDI Machine Control. The
+       * whole range gets the same command.
+       */
+      if (0 != relative) {
+        return config_error(s, to_at, "A jack transport value can not be "
+                            "relative.");
+      }
+      to += from;
+      if (1 == to) {
+        to = JT_STOP;
+      }
+      else if (2 == to) {
+        to = JT_PLAY;
+      }
+      else if (4 == to) {
+        to = JT_FWD;
+      }
+      else if (5 == to) {
+        to = JT_REV;
+      }
+      else if (47 == to) {
+        to = JT_WHEEL;
+      }
+      else {
+        return config_error(s, to_at, "%d is not a valid jack transport "
+                            "value (1, 2, 4, 5, 47).", to);
+      }
+      break;
+    }
+#endif
+    case 'M': {
+      type = TT_NOTE_TO_MMC;
+      *capabilities |= (CB_ALSA_MIDI_IN | CB_ALSA_MIDI_OUT);
+
+      /*
+       * The whole range sends the same command, to the device ID after the
+       * ',' or to all devices.
+       */
+      if (0 != relative) {
+        return config_error(s, to_at, "A MIDI Machine Control command can "
+                            "not be relative.");
+      }
+      to += from;
+      if ((M2M_MMC_STOP > to) ||
+          ((M2M_MMC_REWIND < to) && (M2M_MMC_LOCATE != to))) {
+        return config_error(s, to_at, "%d is not a valid MIDI Machine "
+                            "Control command (1, 2, 3, 4, 5, 68).", to);
+      }
+      if (NULL == channel_at) {
+        channel = -1;
+      }
+      break;
+    }
+    default: {
+      return config_error(s, separator_at, "Separator '%c' is not valid.", c);
+    }
+  }
+
+  debug("Identified line as translation type %d (%c)", type, c);
+
+  /*
+   * Insert the transformation in the translation table, once for every
+   * value in the range, so that a range costs nothing extra when
+   * translating. The from and to values can only be between 0 and 127 and
+   * every note and controller can only be translated once per source
+   * channel, and once for any channel.
+   */
+  for (; from <= last; from++) {
+    int value = ((TT_NOTE_TO_JACK == type) || (TT_NOTE_TO_MMC == type)) ?
+      to : from + to;
+    m2m_result result;
+
+    /*
+     * A velocity layer is added to the rule for the note, which is created
+     * untranslated by the first layer. A curve alone is a layer with all
+     * velocities.
+     */
+    result = m2m_rule_add(rules, type, source_channel, from,
+                          layered ? from : value,
+                          ((0 < channel) || (TT_NOTE_TO_MMC == type)) ?
+                          channel : -1);
+    if (layered && (M2M_DUPLICATE == result)) {
+      result = M2M_OK;
+    }
+    if ((M2M_OK == result) && (layered || curved)) {
+      result = m2m_rule_layer(rules, type, source_channel, from, low, high,
+                              value, curved ? curve : NULL);
+    }
+
+    switch (result) {
+      case M2M_OK: {
+        break;
+      }
+      case M2M_INVALID_TYPE: {
+        return config_error(s, separator_at, "Velocity layers and curves "
+                            "need a note to note or note to controller "
+                            "translation, the same for all layers.");
+      }
+      case M2M_FULL: {
+        if (TT_NOTE_TO_MMC == type) {
+          return config_error(s, to_at, "Too many different MIDI "
+                              "Machine Control commands and device IDs (at "
+                              "most %d).", M2M_MAX_MMC_FRAMES);
+        }
+        return config_error(s, from_at, "Too many notes with velocity "
+                            "layers or curves (at most %d).",
+                            M2M_MAX_VELOCITY_MAPS - 1);
+      }
+      case M2M_INVALID_FROM: {
+        return config_error(s, from_at, "Invalid from value %d (must be "
+                            "0-127).", from);
+      }
+      case M2M_INVALID_TO: {
+        return config_error(s, to_at, "Invalid to value %d for %d (must be "
+                            "0-127).", value, from);
+      }
+      case M2M_DUPLICATE: {
+        return config_error(s, from_at, "Value %d is already translated for "
+                            "the same source channel.", from);
+      }
+      default: {
+        return config_error(s, separator_at, "Type %d is not implemented yet",
+                            type);
+      }
+    }
+  }
+
+  return 0;
+}
+
+
+/*
+ * Parse the mapped configuration file. First line is the file version, the
+ * second line is the name of the MIDI-port to use and the rest is the
+ * actual MIDI note conversion table definition.
+ */
+#ifdef USE_JACK
+static int config_parse(config_scanner *s,
+                        m2m_rules *rules,
+                        char *port_name,
+                        capability *capabilities,
+                        int use_jack) {
+#else
+static int config_parse(config_scanner *s,
+                        m2m_rules *rules,
+                        char *port_name,
+                        capability *capabilities) {
+#endif
+  static const char magic[] = "midi2midi-config-1.";
+  size_t len = sizeof(magic) - 1;
+  const char *name;
+  int version;
+
+  /*
+   * Make sure that we can handle the file version, 1.0 to 1.3.
+   */
+  if (((size_t)(s->end - s->p) < len) || (0 != memcmp(s->p, magic, len))) {
+    return config_error(s, s->p, "The file is not a midi2midi configuration "
+                        "file.");
+  }
+  s->p += len;
+  if ((0 != config_number(s, &version)) || (3 < version)) {
+    return config_error(s, s->line_start + len, "Unknown file version.");
+  }
+  config_skip_blanks(s);
+  if (!config_at_eol(s)) {
+    return config_error(s, s->p, "Unexpected '%c' after the file version.",
+                        *s->p);
+  }
+  debug("The file '%s' is a 1.%d file", s->filename, version);
+  config_next_line(s);
+
+  /*
+   * Get the name of the instance from the configuration file.
+   */
+  if (s->p == s->end) {
+    return config_error(s, s->p, "Could not get MIDI port name.");
+  }
+  name = s->p;
+  while (!config_at_eol(s)) {
+    s->p++;
+  }
+  if (254 < s->p - name) {
+    return config_error(s, name + 254, "The MIDI port name is longer than "
+                        "254 characters.");
+  }
+  memcpy(port_name, name, s->p - name);
+  port_name[s->p - name] = 0;
+  debug("Read port name '%s'", port_name);
+  config_next_line(s);
+
+  while (s->p != s->end) {
+    config_skip_blanks(s);
+#ifdef USE_JACK
+    if (!config_at_eol(s) &&
+        (0 != config_line(s, rules, capabilities, use_jack))) {
+#else
+    if (!config_at_eol(s) &&
+        (0 != config_line(s, rules, capabilities))) {
+#endif
+      return -1;
+    }
+    config_next_line(s);
+  }
+
+  debug("Reached end of file '%s'", s->filename);
+
+  return 0;
+}
+
+
+/*
+ * Parse the specified configuration file and construct translation tables
+ * for both MIDI notes and MIDI Continuous Controls. The file is mapped and
+ * read in one pass, without copying it.
+ */
+#ifdef USE_JACK
+int config_load(const char *filename,
+                m2m_rules *rules,
+                char *port_name,
+                capability *capabilities,
+                char *message,
+                int use_jack) {
+#else
+int config_load(const char *filename,
+                m2m_rules *rules,
+                char *port_name,
+                capability *capabilities,
+                char *message) {
+#endif
+  config_scanner s;
+  struct stat st;
+  void *p = NULL;
+  int fd;
+  int retval;
+
+  /*
+   * Just set the translation tables for both notes and MIDI Continuous
+   * Controls to defaults.
+   */
+  m2m_rules_init(rules);
+
+  if (NULL == filename) {
+    return 0;
+  }
+
+  /*
+   * Open and map the specified configuration file.
+   */
+  if ((fd = open(filename, O_RDONLY | O_CLOEXEC)) < 0) {
+    return config_fail(message, "Unable to open file '%s'.", filename);
+  }
+  if (0 != fstat(fd, &st)) {
+    close(fd);
+    return config_fail(message, "Unable to open file '%s'.", filename);
+  }
+  if ((0 < st.st_size) &&
+      (MAP_FAILED == (p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+                               fd, 0)))) {
+    close(fd);
+    return config_fail(message, "Unable to map file '%s'.", filename);
+  }
+  close(fd);
+
+  debug("Reading file '%s'", filename);
+
+  s.filename = filename;
+  s.p = s.line_start = (NULL != p) ? (const char *)p : "";
+  s.end = s.p + st.st_size;
+  s.line_number = 1;
+  s.message = message;
+
+#ifdef USE_JACK
+  retval = config_parse(&s, rules, port_name, capabilities, use_jack);
+#else
+  retval = config_parse(&s, rules, port_name, capabilities);
+#endif
+
+  if (NULL != p) {
+    munmap(p, st.st_size);
+  }
+
+  return retval;
+}
+
+
+#ifdef USE_JACK
+m2m_rules *config_rules(const char *filename,
+                        char *port_name,
+                        capability *capabilities,
+                        char *message,
+                        int use_jack) {
+#else
+m2m_rules *config_rules(const char *filename,
+                        char *port_name,
+                        capability *capabilities,
+                        char *message) {
+#endif
+  char image_name[4096];
+  char image_message[CONFIG_MESSAGE_SIZE];
+  capability image_capabilities = CB_NONE;
+  m2m_rules *rules;
+  m2m_rules *mapped;
+
+  if (NULL != filename) {
+    snprintf(image_name, sizeof(image_name), "%sc", filename);
+    rules = image_load(image_name, filename, port_name, &image_capabilities);
+    if (NULL != rules) {
+#ifdef USE_JACK
+      if ((0 == use_jack) &&
+          (CB_JACK_TRANSPORT_OUT & image_capabilities)) {
+        warning("Jack features are not enabled, the Jack translations of "
+                "'%s' are ignored. Use -j, --jack to enable them.", filename);
+      }
+#endif
+      *capabilities |= image_capabilities;
+      return rules;
+    }
+  }
+
+  if (NULL == (rules = image_new())) {
+    config_fail(message, "Could not allocate a rule set.");
+    return NULL;
+  }
+
+#ifdef USE_JACK
+  if (0 != config_load(filename, rules, port_name, &image_capabilities,
+                       message, use_jack)) {
+#else
+  if (0 != config_load(filename, rules, port_name, &image_capabilities,
+                       message)) {
+#endif
+    image_delete(rules);
+    return NULL;
+  }
+  *capabilities |= image_capabilities;
+
+  if (NULL == filename) {
+    return rules;
+  }
+
+  /*
+   * A configuration file in a read-only place is simply parsed every time.
+   */
+  if (0 != image_save(image_name, filename, rules, port_name,
+                      image_capabilities, image_message)) {
+    debug("%s", image_message);
+    return rules;
+  }
+
+  /*
+   * Use the new image right away, so that its pages are shared too.
+   */
+  mapped = image_load(image_name, filename, port_name, &image_capabilities);
+  if (NULL != mapped) {
+    image_delete(rules);
+    rules = mapped;
+  }
+
+  return rules;
+}
@@ -0,0 +1,100 @@
+/*
+ * config.h
+ *
+ * Copyright (C)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * About
+ * -----
+ *
+ * Author: AiO <aio at aio dot nu>
+ *
+ * Simple API for reading midi2midi configuration files.
+ *
+ */
+
+#ifndef _CONFIG_H_
+#define _CONFIG_H_
+
+#include "m2m.h"
+
+/*
+ * Type definition for keeping track of the needed resource capabilities
+ * for the running instance of this program.
+ */
+typedef enum {
+  CB_NONE = 0,
+  CB_ALSA_MIDI_IN = 1,
+  CB_ALSA_MIDI_OUT = 2,
+#ifdef USE_JACK
+  CB_JACK_TRANSPORT_OUT = 4
+#endif
+} capability;
+
+
+/*
+ * Size of the buffer config_load() describes errors in.
+ */
+#define CONFIG_MESSAGE_SIZE 255
+
+
+/*
+ * Parse the specified configuration file into a rule set. The port name
+ * from the file is stored in port_name, which must hold 255 characters,
+ * and the capabilities the rules need are added to capabilities. Without
+ * a file name the rule set lets everything through. Returns 0 on success,
+ * or -1 with the problem described in message, which must hold
+ * CONFIG_MESSAGE_SIZE characters, as "file:line:column: problem" when it
+ * is in the file.
+ */
+#ifdef USE_JACK
+int config_load(const char *filename,
+                m2m_rules *rules,
+                char *port_name,
+                capability *capabilities,
+                char *message,
+                int use_jack);
+#else
+int config_load(const char *filename,
+                m2m_rules *rules,
+                char *port_name,
+                capability *capabilities,
+                char *message);
+#endif
+
+
+
+/*
+ * Get the rule set of the specified configuration file, like config_load()
+ * but from its compiled image, the file name with a 'c' appended, when the
+ * image is up to date. Otherwise the file is parsed and the image rebuilt,
+ * if possible, for the next time. Returns NULL, with the problem described
+ * in message, if the file is not valid. Free the rules with image_delete().
+ */
+#ifdef USE_JACK
+m2m_rules *config_rules(const char *filename,
+                        char *port_name,
+                        capability *capabilities,
+                        char *message,
+                        int use_jack);
+#else
+m2m_rules *config_rules(const char *filename,
+                        char *port_name,
+                        capability *capabilities,
+                        char *message);
+#endif
+
+#endif /* _CONFIG_H_ */
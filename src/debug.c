@@ -23,28 +23,100 @@
  *
  * Author: AiO <aio at aio dot nu>
  *
- * Simple implementation for debug output from a program.
+ * Simple implementation for debug output from a program. Handed over to
+ * the debug thread, a message is recorded in a bounded queue where every
+ * slot has a sequence number telling if it is free or filled, so any
+ * number of threads can write to it. The format string is only walked to
+ * copy the arguments, strings into the record itself, and the debug thread
+ * formats the message from the record.
  *
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
 
 #include "debug.h"
 
+/*
+ * Number of messages that can wait for the debug thread, a power of two.
+ */
+#define DEBUG_RING_SIZE 1024
+
+/*
+ * Largest number of arguments of a recorded message, and room for the
+ * characters of all its string arguments, longer strings are cut.
+ */
+#define DEBUG_MAX_ARGS 8
+#define DEBUG_TEXT_SIZE 64
+
+/*
+ * How often the debug thread looks for messages, in nanoseconds.
+ */
+#define DEBUG_INTERVAL 10000000L
+
+typedef enum {
+  DEBUG_INT,
+  DEBUG_LONG,
+  DEBUG_LONG_LONG,
+  DEBUG_SIZE
+} debug_length;
+
+typedef union {
+  long long i;
+  unsigned long long u;
+  double d;
+  const void *p;
+} debug_arg;
+
+typedef struct {
+  size_t sequence;
+  const char *filename;
+  int line_number;
+  const char *format;
+  int nargs;
+  debug_arg args[DEBUG_MAX_ARGS];
+  char text[DEBUG_TEXT_SIZE];
+} debug_record;
+
+typedef struct {
+  /*
+   * Written by the threads writing messages.
+   */
+  size_t head;
+  uint64_t dropped;
+
+  /*
+   * Only used by the debug thread.
+   */
+  size_t tail;
+  int stop;
+  pthread_t thread;
+
+  debug_record records[DEBUG_RING_SIZE];
+} debug_ring;
+
 
 /*
  * Remember which mode we are in.
  */
-static int debug_enabled = 0;
+int __debug_enabled = 0;
+static int debug_async = 0;
+static debug_ring ring;
 
 
 /*
  * Enable debug outputs.
  */
 void debug_enable() {
-  debug_enabled = 1;
+  __debug_enabled = 1;
 }
 
 
@@ -52,7 +124,353 @@ void debug_enable() {
  * Get debuging enable status.
  */
 int debug_is_enabled() {
-  return debug_enabled;
+  return __debug_enabled;
+}
+
+
+/*
+ * Skip the flags, width, precision and length modifier of a conversion
+ * specification, p is just after its '%'. Returns the conversion
+ * character, with the length modifier in length and the end of the
+ * specification in end.
+ */
+static char debug_conversion(const char *p,
+                             debug_length *length,
+                             const char **end) {
+  *length = DEBUG_INT;
+
+  while (('\0' != *p) && (NULL != strchr("-+ #0123456789.", *p))) {
+    p++;
+  }
+  if ('h' == *p) {
+    p += ('h' == p[1]) ? 2 : 1;
+  }
+  else if ('l' == *p) {
+    *length = ('l' == p[1]) ? DEBUG_LONG_LONG : DEBUG_LONG;
+    p += ('l' == p[1]) ? 2 : 1;
+  }
+  else if ('z' == *p) {
+    *length = DEBUG_SIZE;
+    p++;
+  }
+
+  *end = ('\0' == *p) ? p : p + 1;
+
+  return *p;
+}
+
+
+/*
+ * Copy the arguments of a message into a record. Recording stops at the
+ * first conversion that is not understood, the rest of the message is
+ * printed as it is.
+ */
+static void debug_record_args(debug_record *r, va_list ap) {
+  const char *p = r->format;
+  size_t used = 0;
+
+  r->nargs = 0;
+
+  while ('\0' != *p) {
+    debug_length length;
+    debug_arg *arg;
+    char conversion;
+
+    if ('%' != *p++) {
+      continue;
+    }
+    conversion = debug_conversion(p, &length, &p);
+    if ('%' == conversion) {
+      continue;
+    }
+    if (DEBUG_MAX_ARGS == r->nargs) {
+      return;
+    }
+
+    arg = &r->args[r->nargs];
+    switch (conversion) {
+      case 'd':
+      case 'i':
+      case 'c': {
+        arg->i = (DEBUG_LONG == length) ? va_arg(ap, long) :
+                 (DEBUG_LONG_LONG == length) ? va_arg(ap, long long) :
+                 (DEBUG_SIZE == length) ? (long long)va_arg(ap, size_t) :
+                 va_arg(ap, int);
+        break;
+      }
+      case 'u':
+      case 'x':
+      case 'X':
+      case 'o': {
+        arg->u = (DEBUG_LONG == length) ? va_arg(ap, unsigned long) :
+                 (DEBUG_LONG_LONG == length) ?
+                 va_arg(ap, unsigned long long) :
+                 (DEBUG_SIZE == length) ? va_arg(ap, size_t) :
+                 va_arg(ap, unsigned int);
+        break;
+      }
+      case 'f':
+      case 'e':
+      case 'g':
+      case 'E':
+      case 'G': {
+        arg->d = va_arg(ap, double);
+        break;
+      }
+      case 'p': {
+        arg->p = va_arg(ap, void *);
+        break;
+      }
+      case 's': {
+        /*
+         * The string may be gone by the time the message is printed.
+         */
+        const char *string = va_arg(ap, const char *);
+        size_t n;
+        if (NULL == string) {
+          string = "(null)";
+        }
+        n = strlen(string);
+        if (n > DEBUG_TEXT_SIZE - 1 - used) {
+          n = DEBUG_TEXT_SIZE - 1 - used;
+        }
+        memcpy(&r->text[used], string, n);
+        r->text[used + n] = '\0';
+        arg->i = used;
+        used += n + ((DEBUG_TEXT_SIZE - 1 == used + n) ? 0 : 1);
+        break;
+      }
+      default: {
+        return;
+      }
+    }
+    r->nargs++;
+  }
+}
+
+
+/*
+ * Record a message for the debug thread, or count it as dropped if the
+ * ring is full.
+ */
+static void debug_record_message(const char *filename,
+                                 int line_number,
+                                 const char *format,
+                                 va_list ap) {
+  size_t head = __atomic_load_n(&ring.head, __ATOMIC_RELAXED);
+  debug_record *r;
+
+  while (1) {
+    size_t sequence;
+
+    r = &ring.records[head & (DEBUG_RING_SIZE - 1)];
+    sequence = __atomic_load_n(&r->sequence, __ATOMIC_ACQUIRE);
+    if (sequence == head) {
+      if (__atomic_compare_exchange_n(&ring.head, &head, head + 1, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        break;
+      }
+    }
+    else if ((long)(sequence - head) < 0) {
+      __atomic_add_fetch(&ring.dropped, 1, __ATOMIC_RELAXED);
+      return;
+    }
+    else {
+      head = __atomic_load_n(&ring.head, __ATOMIC_RELAXED);
+    }
+  }
+
+  r->filename = filename;
+  r->line_number = line_number;
+  r->format = format;
+  debug_record_args(r, ap);
+  __atomic_store_n(&r->sequence, head + 1, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * Format and print a recorded message, one conversion at a time.
+ */
+static void debug_print(const debug_record *r) {
+  const char *p = r->format;
+  int i = 0;
+
+  fprintf(stdout, "DEBUG: ");
+
+  while ('\0' != *p) {
+    const char *end;
+    const debug_arg *arg;
+    debug_length length;
+    char spec[32];
+    char conversion;
+
+    if ('%' != *p) {
+      end = strchr(p, '%');
+      if (NULL == end) {
+        end = p + strlen(p);
+      }
+      fwrite(p, 1, end - p, stdout);
+      p = end;
+      continue;
+    }
+
+    conversion = debug_conversion(p + 1, &length, &end);
+    if ('%' == conversion) {
+      fputc('%', stdout);
+      p = end;
+      continue;
+    }
+    if ((i == r->nargs) || ((size_t)(end - p) >= sizeof(spec))) {
+      fputs(p, stdout);
+      break;
+    }
+    memcpy(spec, p, end - p);
+    spec[end - p] = '\0';
+    arg = &r->args[i++];
+
+    switch (conversion) {
+      case 'd':
+      case 'i':
+      case 'c': {
+        if (DEBUG_LONG == length) {
+          fprintf(stdout, spec, (long)arg->i);
+        }
+        else if (DEBUG_LONG_LONG == length) {
+          fprintf(stdout, spec, arg->i);
+        }
+        else if (DEBUG_SIZE == length) {
+          fprintf(stdout, spec, (size_t)arg->i);
+        }
+        else {
+          fprintf(stdout, spec, (int)arg->i);
+        }
+        break;
+      }
+      case 'u':
+      case 'x':
+      case 'X':
+      case 'o': {
+        if (DEBUG_LONG == length) {
+          fprintf(stdout, spec, (unsigned long)arg->u);
+        }
+        else if (DEBUG_LONG_LONG == length) {
+          fprintf(stdout, spec, arg->u);
+        }
+        else if (DEBUG_SIZE == length) {
+          fprintf(stdout, spec, (size_t)arg->u);
+        }
+        else {
+          fprintf(stdout, spec, (unsigned int)arg->u);
+        }
+        break;
+      }
+      case 'p': {
+        fprintf(stdout, spec, arg->p);
+        break;
+      }
+      case 's': {
+        fprintf(stdout, spec, &r->text[arg->i]);
+        break;
+      }
+      default: {
+        fprintf(stdout, spec, arg->d);
+        break;
+      }
+    }
+    p = end;
+  }
+
+  fprintf(stdout, " (in %s on line %d)\n", r->filename, r->line_number);
+}
+
+
+/*
+ * Print every message in the ring, and how many were dropped.
+ */
+static void debug_drain() {
+  uint64_t dropped;
+
+  while (1) {
+    debug_record *r = &ring.records[ring.tail & (DEBUG_RING_SIZE - 1)];
+
+    if (__atomic_load_n(&r->sequence, __ATOMIC_ACQUIRE) != ring.tail + 1) {
+      break;
+    }
+    debug_print(r);
+    __atomic_store_n(&r->sequence, ring.tail + DEBUG_RING_SIZE,
+                     __ATOMIC_RELEASE);
+    ring.tail++;
+  }
+
+  dropped = __atomic_exchange_n(&ring.dropped, 0, __ATOMIC_RELAXED);
+  if (0 != dropped) {
+    fprintf(stdout, "DEBUG: %lu messages were dropped\n",
+            (unsigned long)dropped);
+  }
+  fflush(stdout);
+}
+
+
+/*
+ * The debug thread.
+ */
+static void *debug_run(void *arg) {
+  struct timespec interval = { 0, DEBUG_INTERVAL };
+  int stop;
+
+  do {
+    stop = __atomic_load_n(&ring.stop, __ATOMIC_ACQUIRE);
+    debug_drain();
+    if (0 == stop) {
+      nanosleep(&interval, NULL);
+    }
+  } while (0 == stop);
+
+  return arg;
+}
+
+
+void debug_async_start() {
+  sigset_t all, old;
+  int result;
+  size_t i;
+
+  if (0 != debug_async) {
+    return;
+  }
+
+  for (i = 0; i < DEBUG_RING_SIZE; i++) {
+    ring.records[i].sequence = i;
+  }
+  ring.head = ring.tail = 0;
+  ring.dropped = 0;
+  ring.stop = 0;
+
+  /*
+   * The thread is created with every signal blocked, so that the signals
+   * the application waits for are never delivered to it.
+   */
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, &old);
+  result = pthread_create(&ring.thread, NULL, debug_run, NULL);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  if (0 != result) {
+    fprintf(stdout, "DEBUG: Could not start the debug thread\n");
+    return;
+  }
+  __atomic_store_n(&debug_async, 1, __ATOMIC_RELEASE);
+
+  atexit(debug_async_stop);
+}
+
+
+void debug_async_stop() {
+  if (0 == __atomic_exchange_n(&debug_async, 0, __ATOMIC_ACQ_REL)) {
+    return;
+  }
+
+  __atomic_store_n(&ring.stop, 1, __ATOMIC_RELEASE);
+  pthread_join(ring.thread, NULL);
 }
 
 
@@ -63,13 +481,18 @@ int debug_is_enabled() {
 void __debug(const char *filename, int line_number, const char *format, ...) {
   va_list ap;
 
-  if (0 == debug_enabled) {
+  if (0 == __debug_enabled) {
     return;
   }
 
-  fprintf(stdout, "DEBUG: ");
-
   va_start(ap, format);
+  if (0 != __atomic_load_n(&debug_async, __ATOMIC_ACQUIRE)) {
+    debug_record_message(filename, line_number, format, ap);
+    va_end(ap);
+    return;
+  }
+
+  fprintf(stdout, "DEBUG: ");
   vfprintf(stdout, format, ap);
   va_end(ap);
 
@@ -81,5 +504,5 @@ void __debug(const char *filename, int line_number, const char *format, ...) {
  * Disable debug outputs.
  */
 void debug_disable() {
-  debug_enabled = 0;
+  __debug_enabled = 0;
 }
@@ -23,13 +23,30 @@
  *
  * Author: AiO <aio at aio dot nu>
  *
- * Simple API for debug output from a program.
+ * Simple API for debug output from a program. Debug messages are compiled
+ * in up to DEBUG_LEVEL, and the ones that are compiled in are only printed
+ * when debug output is enabled. They can be printed directly, or handed
+ * over to a thread of its own that does the formatting and printing.
  *
  */
 
 #ifndef _DEBUG_H_
 #define _DEBUG_H_
 
+/*
+ * Debug levels. DEBUG_LEVEL_NONE leaves every debug message out of the
+ * build, DEBUG_LEVEL_DEBUG keeps the debug() messages and
+ * DEBUG_LEVEL_TRACE (the default) also keeps the trace() messages, which
+ * are written for every event. Build with DEBUG_LEVEL=<level> to change it.
+ */
+#define DEBUG_LEVEL_NONE 0
+#define DEBUG_LEVEL_DEBUG 1
+#define DEBUG_LEVEL_TRACE 2
+
+#ifndef DEBUG_LEVEL
+#define DEBUG_LEVEL DEBUG_LEVEL_TRACE
+#endif
+
 
 /*
  * Enable debug outputs.
@@ -42,11 +59,42 @@ void debug_enable();
  */
 int debug_is_enabled();
 
+
 /*
- * Macro and function to output a debug string with some valuable information
- * around where in the code the error macro was called and such.
+ * Print debug messages from a thread of its own from now on. A debug
+ * message then only costs the thread writing it a copy of its arguments
+ * into a ring, without locks or system calls. Messages that do not fit in
+ * the ring are dropped and counted. What is left in the ring is printed
+ * at exit.
  */
-#define debug(format, ...) __debug(__FILE__, __LINE__, format, __VA_ARGS__)
+void debug_async_start();
+
+
+/*
+ * Print what is left in the ring and print every debug message directly
+ * again.
+ */
+void debug_async_stop();
+
+
+/*
+ * Macros and function to output a debug string with some valuable
+ * information around where in the code the debug macro was called and such.
+ * A message above DEBUG_LEVEL is still checked by the compiler but never
+ * built, and the arguments of a message are not even evaluated when debug
+ * output is not enabled.
+ */
+extern int __debug_enabled;
+
+#define __debug_at(level, format, ...)                        \
+  do {                                                        \
+    if ((DEBUG_LEVEL >= (level)) && (0 != __debug_enabled)) { \
+      __debug(__FILE__, __LINE__, format, __VA_ARGS__);       \
+    }                                                         \
+  } while (0)
+
+#define debug(format, ...) __debug_at(DEBUG_LEVEL_DEBUG, format, __VA_ARGS__)
+#define trace(format, ...) __debug_at(DEBUG_LEVEL_TRACE, format, __VA_ARGS__)
 void __debug(const char *filename, int line_number, const char *format, ...);
 
 
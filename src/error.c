@@ -57,3 +57,25 @@ void __error(const char *filename, int line_number, const char *format, ...) {
 
   exit(EXIT_FAILURE);
 }
+
+
+/*
+ * Function to output a warning string, same as __error() but the program
+ * keeps running.
+ */
+void __warning(const char *filename, int line_number, const char *format, ...) {
+  va_list ap;
+
+  fprintf(stderr, "WARNING: ");
+
+  va_start(ap, format);
+  vfprintf(stderr, format, ap);
+  va_end(ap);
+
+  if (debug_is_enabled()) {
+    fprintf(stderr, " (in %s on line %d)\n", filename, line_number);
+  }
+  else {
+    fprintf(stderr, "\n");
+  }
+}
@@ -38,4 +38,12 @@
 #define error(format, ...) __error(__FILE__, __LINE__, format, __VA_ARGS__)
 void __error(const char *filename, int line_number, const char *format, ...);
 
+
+/*
+ * Macro and function to output a warning string about something that did
+ * not work out but that the program can recover from.
+ */
+#define warning(format, ...) __warning(__FILE__, __LINE__, format, __VA_ARGS__)
+void __warning(const char *filename, int line_number, const char *format, ...);
+
 #endif /* _ERROR_H_ */
@@ -0,0 +1,218 @@
+/*
+ * event_loop.c
+ *
+ * Copyright (C)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * About
+ * -----
+ *
+ * Author: AiO <aio at aio dot nu>
+ *
+ * This is a simplified implementation for waiting on several file
+ * descriptors at once using epoll, with an eventfd for internal wake-ups
+ * and a timerfd for the timer.
+ *
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+#include "error.h"
+#include "event_loop.h"
+
+/*
+ * Maximum number of ready sources collected per wait.
+ */
+#define EVENT_LOOP_MAX_EVENTS 16
+
+struct event_loop {
+  int epoll_fd;
+  int wakeup_fd;
+  int timer_fd;
+  uint64_t timer;
+};
+
+
+/*
+ * Allocate a new event loop with an internal wake-up source.
+ */
+event_loop *event_loop_new() {
+  event_loop *loop = malloc(sizeof(event_loop));
+
+  if (NULL == loop) {
+    error("Could not allocate an event loop%c", '.');
+  }
+
+  if ((loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+    error("Could not create an epoll instance (errno %d).", errno);
+  }
+
+  if ((loop->wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+    error("Could not create a wake-up eventfd (errno %d).", errno);
+  }
+
+  event_loop_add(loop, loop->wakeup_fd, POLLIN, EVENT_LOOP_WAKEUP);
+
+  if ((loop->timer_fd = timerfd_create(CLOCK_MONOTONIC,
+                                       TFD_NONBLOCK | TFD_CLOEXEC)) < 0) {
+    error("Could not create a timerfd (errno %d).", errno);
+  }
+  loop->timer = 0;
+
+  event_loop_add(loop, loop->timer_fd, POLLIN, EVENT_LOOP_TIMER);
+
+  return loop;
+}
+
+
+/*
+ * Add or change a file descriptor in the epoll set.
+ */
+static void event_loop_ctl(event_loop *loop, int op, int fd, short events,
+                           int source) {
+  struct epoll_event ev;
+
+  ev.events = 0;
+  if (events & POLLIN) {
+    ev.events |= EPOLLIN;
+  }
+  if (events & POLLOUT) {
+    ev.events |= EPOLLOUT;
+  }
+  ev.data.u64 = 0;
+  ev.data.u32 = (uint32_t)source;
+
+  if (epoll_ctl(loop->epoll_fd, op, fd, &ev) < 0) {
+    error("Could not %s file descriptor %d in the event loop (errno %d).",
+          (EPOLL_CTL_ADD == op) ? "add" : "change", fd, errno);
+  }
+}
+
+
+/*
+ * Add a file descriptor to wait for.
+ */
+void event_loop_add(event_loop *loop, int fd, short events, int source) {
+  event_loop_ctl(loop, EPOLL_CTL_ADD, fd, events, source);
+}
+
+
+/*
+ * Change what to wait for on an added file descriptor.
+ */
+void event_loop_modify(event_loop *loop, int fd, short events, int source) {
+  event_loop_ctl(loop, EPOLL_CTL_MOD, fd, events, source);
+}
+
+
+/*
+ * Block until at least one source is ready.
+ */
+int event_loop_wait(event_loop *loop, int *sources, int max) {
+  struct epoll_event events[EVENT_LOOP_MAX_EVENTS];
+  int i, n;
+
+  if (max > EVENT_LOOP_MAX_EVENTS) {
+    max = EVENT_LOOP_MAX_EVENTS;
+  }
+
+  do {
+    n = epoll_wait(loop->epoll_fd, events, max, -1);
+  } while ((n < 0) && (EINTR == errno));
+
+  if (n < 0) {
+    error("Waiting for events failed (errno %d).", errno);
+  }
+
+  for (i = 0; i < n; i++) {
+    sources[i] = (int)events[i].data.u32;
+
+    if (EVENT_LOOP_WAKEUP == sources[i]) {
+      uint64_t count;
+      /*
+       * Reset the eventfd counter, it is non-blocking so a concurrent
+       * reset just makes this read fail with EAGAIN.
+       */
+      if (read(loop->wakeup_fd, &count, sizeof(count)) < 0) {
+        continue;
+      }
+    }
+    else if (EVENT_LOOP_TIMER == sources[i]) {
+      uint64_t count;
+      loop->timer = 0;
+      if (read(loop->timer_fd, &count, sizeof(count)) < 0) {
+        continue;
+      }
+    }
+  }
+
+  return n;
+}
+
+
+/*
+ * Set or cancel the timer, without a system call when nothing changes.
+ */
+void event_loop_timer(event_loop *loop, uint64_t when) {
+  struct itimerspec its = { { 0, 0 }, { 0, 0 } };
+
+  if (when == loop->timer) {
+    return;
+  }
+
+  its.it_value.tv_sec = when / 1000000000ULL;
+  its.it_value.tv_nsec = when % 1000000000ULL;
+  if (timerfd_settime(loop->timer_fd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+    error("Could not set the event loop timer (errno %d).", errno);
+  }
+  loop->timer = when;
+}
+
+
+/*
+ * Make a blocked event_loop_wait() return EVENT_LOOP_WAKEUP.
+ */
+void event_loop_wakeup(event_loop *loop) {
+  uint64_t one = 1;
+
+  if (write(loop->wakeup_fd, &one, sizeof(one)) < 0) {
+    /*
+     * The counter is already at its maximum, so a wake-up is pending anyway.
+     */
+    return;
+  }
+}
+
+
+/*
+ * Cleanup an event loop.
+ */
+void event_loop_delete(event_loop *loop) {
+  close(loop->timer_fd);
+  close(loop->wakeup_fd);
+  close(loop->epoll_fd);
+  free(loop);
+}
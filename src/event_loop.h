@@ -0,0 +1,98 @@
+/*
+ * event_loop.h
+ *
+ * Copyright (C)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * About
+ * -----
+ *
+ * Author: AiO <aio at aio dot nu>
+ *
+ * This is a simplified API for waiting on several file descriptors at once
+ * without any time-outs, so that an idle program never wakes up.
+ *
+ */
+
+#ifndef _EVENT_LOOP_H_
+#define _EVENT_LOOP_H_
+
+#include <stdint.h>
+
+/*
+ * Source identifier reported when event_loop_wakeup() was called.
+ */
+#define EVENT_LOOP_WAKEUP -1
+
+/*
+ * Source identifier reported when the time set with event_loop_timer() has
+ * come.
+ */
+#define EVENT_LOOP_TIMER -2
+
+typedef struct event_loop event_loop;
+
+
+/*
+ * Allocate a new event loop with an internal wake-up source.
+ */
+event_loop *event_loop_new();
+
+
+/*
+ * Add a file descriptor to wait for. The events are poll()-style (POLLIN,
+ * POLLOUT) and the source identifier is what event_loop_wait() reports when
+ * the descriptor is ready.
+ */
+void event_loop_add(event_loop *loop, int fd, short events, int source);
+
+
+/*
+ * Change the events to wait for on a file descriptor that was added, for
+ * example to wait for room to write only while there is something to
+ * write.
+ */
+void event_loop_modify(event_loop *loop, int fd, short events, int source);
+
+
+/*
+ * Block until at least one source is ready and store the identifiers of up
+ * to max ready sources in the sources array. Returns the number stored.
+ */
+int event_loop_wait(event_loop *loop, int *sources, int max);
+
+
+/*
+ * Make event_loop_wait() return EVENT_LOOP_TIMER once at the given
+ * monotonic time in nanoseconds, as from timestamp_now(), replacing any
+ * earlier time. A time of 0 cancels the timer.
+ */
+void event_loop_timer(event_loop *loop, uint64_t when);
+
+
+/*
+ * Make a blocked event_loop_wait() return EVENT_LOOP_WAKEUP. This is safe
+ * to call from any thread.
+ */
+void event_loop_wakeup(event_loop *loop);
+
+
+/*
+ * Cleanup an event loop.
+ */
+void event_loop_delete(event_loop *loop);
+
+#endif /* _EVENT_LOOP_H_ */
@@ -0,0 +1,158 @@
+/*
+ * histogram.c
+ *
+ * Copyright (C)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * About
+ * -----
+ *
+ * Author: AiO <aio at aio dot nu>
+ *
+ * Simple implementation of lock-free log-linear histograms.
+ *
+ */
+
+#include <string.h>
+
+#include "histogram.h"
+
+
+/*
+ * Get the bucket a value belongs in. Values below HISTOGRAM_SUB have a
+ * bucket each, above that each power of two gets HISTOGRAM_SUB buckets.
+ */
+static int histogram_index(uint64_t value) {
+  int msb;
+
+  if (value < HISTOGRAM_SUB) {
+    return (int)value;
+  }
+
+  msb = 63 - __builtin_clzll(value);
+  if (msb >= HISTOGRAM_MAX_BITS) {
+    return HISTOGRAM_BUCKETS - 1;
+  }
+
+  return (msb - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB +
+    (int)((value >> (msb - HISTOGRAM_SUB_BITS)) & (HISTOGRAM_SUB - 1));
+}
+
+
+/*
+ * Get the largest value that ends up in a bucket.
+ */
+static uint64_t histogram_bucket_end(int index) {
+  int group = index / HISTOGRAM_SUB;
+  uint64_t sub = index % HISTOGRAM_SUB;
+
+  if (0 == group) {
+    return sub;
+  }
+
+  return ((HISTOGRAM_SUB + sub + 1) << (group - 1)) - 1;
+}
+
+
+/*
+ * Reset a histogram.
+ */
+void histogram_init(histogram *h) {
+  memset(h, 0, sizeof(*h));
+}
+
+
+/*
+ * Record one value.
+ */
+void histogram_record(histogram *h, uint64_t value) {
+  uint64_t max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+
+  __atomic_fetch_add(&h->buckets[histogram_index(value)], 1,
+                     __ATOMIC_RELAXED);
+  __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+
+  while ((value > max) &&
+         !__atomic_compare_exchange_n(&h->max, &max, value, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    /*
+     * max was updated with the current value, try again.
+     */
+  }
+}
+
+
+/*
+ * Add all values recorded in one histogram to another.
+ */
+void histogram_add(histogram *to, const histogram *from) {
+  int i;
+
+  for (i = 0; i < HISTOGRAM_BUCKETS; i++) {
+    to->buckets[i] += __atomic_load_n(&from->buckets[i], __ATOMIC_RELAXED);
+  }
+  to->count += histogram_count(from);
+  if (histogram_max(from) > to->max) {
+    to->max = histogram_max(from);
+  }
+}
+
+
+/*
+ * Get the number of recorded values.
+ */
+uint64_t histogram_count(const histogram *h) {
+  return __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+}
+
+
+/*
+ * Get the largest recorded value.
+ */
+uint64_t histogram_max(const histogram *h) {
+  return __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+}
+
+
+/*
+ * Get the value below which the given fraction of all values fall.
+ */
+uint64_t histogram_percentile(const histogram *h, double fraction) {
+  uint64_t count = histogram_count(h);
+  uint64_t rank = (uint64_t)(fraction * count + 0.5);
+  uint64_t seen = 0;
+  int i;
+
+  if (0 == count) {
+    return 0;
+  }
+  if (0 == rank) {
+    rank = 1;
+  }
+
+  for (i = 0; i < HISTOGRAM_BUCKETS; i++) {
+    seen += __atomic_load_n(&h->buckets[i], __ATOMIC_RELAXED);
+    if (seen >= rank) {
+      uint64_t end = histogram_bucket_end(i);
+      /*
+       * Never report more than what was actually seen.
+       */
+      return (end < histogram_max(h)) ? end : histogram_max(h);
+    }
+  }
+
+  return histogram_max(h);
+}
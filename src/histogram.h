@@ -0,0 +1,90 @@
+/*
+ * histogram.h
+ *
+ * Copyright (C)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * About
+ * -----
+ *
+ * Author: AiO <aio at aio dot nu>
+ *
+ * Simple API for lock-free log-linear histograms. Every power of two is
+ * split into 16 linear buckets, so a reported value is never more than
+ * 1/16 (6.25%) above the recorded one. Recording may be done from any
+ * number of threads at once.
+ *
+ */
+
+#ifndef _HISTOGRAM_H_
+#define _HISTOGRAM_H_
+
+#include <stdint.h>
+
+#define HISTOGRAM_SUB_BITS 4
+#define HISTOGRAM_SUB (1 << HISTOGRAM_SUB_BITS)
+
+/*
+ * Values of 2^40 and above all end up in the last bucket.
+ */
+#define HISTOGRAM_MAX_BITS 40
+#define HISTOGRAM_BUCKETS \
+  ((HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB)
+
+typedef struct {
+  uint64_t count;
+  uint64_t max;
+  uint64_t buckets[HISTOGRAM_BUCKETS];
+} histogram;
+
+
+/*
+ * Reset a histogram.
+ */
+void histogram_init(histogram *h);
+
+
+/*
+ * Record one value.
+ */
+void histogram_record(histogram *h, uint64_t value);
+
+
+/*
+ * Add all values recorded in one histogram to another.
+ */
+void histogram_add(histogram *to, const histogram *from);
+
+
+/*
+ * Get the number of recorded values.
+ */
+uint64_t histogram_count(const histogram *h);
+
+
+/*
+ * Get the largest recorded value.
+ */
+uint64_t histogram_max(const histogram *h);
+
+
+/*
+ * Get the value below which the given fraction (0.0 - 1.0) of all recorded
+ * values fall, rounded up to the end of its bucket.
+ */
+uint64_t histogram_percentile(const histogram *h, double fraction);
+
+#endif /* _HISTOGRAM_H_ */
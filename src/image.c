@@ -0,0 +1,224 @@
+/*
+ * image.c
+ *
+ * Copyright (C)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * About
+ * -----
+ *
+ * Author: AiO <aio at aio dot nu>
+ *
+ * Simple implementation of compiled rule images. Both mapped images and
+ * rule sets read from text live in a mapping that starts with the header
+ * page, so they are freed the same way. Images are mapped read-only, the
+ * options of a run are kept apart from the rule set.
+ *
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "error.h"
+#include "debug.h"
+#include "image.h"
+
+/*
+ * The header takes one page, so the rules start page aligned.
+ */
+#define IMAGE_HEADER_SIZE 4096
+
+#define IMAGE_SIZE (IMAGE_HEADER_SIZE + sizeof(m2m_rules))
+
+#ifdef USE_JACK
+#define IMAGE_BUILD 1
+#else
+#define IMAGE_BUILD 0
+#endif
+
+/*
+ * Everything that must match for an image to be used. The size of the
+ * rule set changes with the engine, the build with the Jack support, and
+ * the modification time and size of the configuration file tell if the
+ * image is stale.
+ */
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t rules_size;
+  uint32_t build;
+  uint32_t capabilities;
+  int64_t source_sec;
+  int64_t source_nsec;
+  int64_t source_size;
+  char port_name[256];
+} image_header;
+
+static const char image_magic[8] = "M2MIMG\n";
+
+
+/*
+ * Fill in the header for the configuration file source, returns -1 if it
+ * can not be looked at.
+ */
+static int image_header_init(image_header *header, const char *source) {
+  struct stat st;
+
+  if (0 != stat(source, &st)) {
+    return -1;
+  }
+
+  memset(header, 0, sizeof(*header));
+  memcpy(header->magic, image_magic, sizeof(image_magic));
+  header->version = IMAGE_VERSION;
+  header->rules_size = sizeof(m2m_rules);
+  header->build = IMAGE_BUILD;
+  header->source_sec = st.st_mtim.tv_sec;
+  header->source_nsec = st.st_mtim.tv_nsec;
+  header->source_size = st.st_size;
+
+  return 0;
+}
+
+
+m2m_rules *image_new() {
+  void *p = mmap(NULL, IMAGE_SIZE, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  if (MAP_FAILED == p) {
+    return NULL;
+  }
+
+  return (m2m_rules *)((char *)p + IMAGE_HEADER_SIZE);
+}
+
+
+m2m_rules *image_load(const char *filename,
+                      const char *source,
+                      char *port_name,
+                      capability *capabilities) {
+  image_header expected;
+  const image_header *header;
+  struct stat st;
+  void *p;
+  int fd;
+
+  if (0 != image_header_init(&expected, source)) {
+    return NULL;
+  }
+
+  if ((fd = open(filename, O_RDONLY | O_CLOEXEC)) < 0) {
+    debug("No image '%s'", filename);
+    return NULL;
+  }
+
+  if ((0 != fstat(fd, &st)) || (IMAGE_SIZE != (size_t)st.st_size)) {
+    debug("Image '%s' has the wrong size", filename);
+    close(fd);
+    return NULL;
+  }
+
+  p = mmap(NULL, IMAGE_SIZE, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (MAP_FAILED == p) {
+    return NULL;
+  }
+
+  /*
+   * Everything but the port name and capabilities must be as expected.
+   */
+  header = (const image_header *)p;
+  if ((0 != memcmp(header, &expected,
+                   offsetof(image_header, capabilities))) ||
+      (header->source_sec != expected.source_sec) ||
+      (header->source_nsec != expected.source_nsec) ||
+      (header->source_size != expected.source_size)) {
+    debug("Image '%s' is stale", filename);
+    munmap(p, IMAGE_SIZE);
+    return NULL;
+  }
+
+  memcpy(port_name, header->port_name, 254);
+  port_name[254] = 0;
+  *capabilities |= (capability)header->capabilities;
+
+  debug("Mapped image '%s'", filename);
+
+  return (m2m_rules *)((char *)p + IMAGE_HEADER_SIZE);
+}
+
+
+int image_save(const char *filename,
+               const char *source,
+               const m2m_rules *rules,
+               const char *port_name,
+               capability capabilities,
+               char *message) {
+  char page[IMAGE_HEADER_SIZE];
+  image_header *header = (image_header *)page;
+  char tmp[4096];
+  int fd, ok;
+
+  memset(page, 0, sizeof(page));
+  if (0 != image_header_init(header, source)) {
+    snprintf(message, CONFIG_MESSAGE_SIZE, "Unable to open file '%.200s'.",
+             source);
+    return -1;
+  }
+  header->capabilities = capabilities;
+  strncpy(header->port_name, port_name, sizeof(header->port_name) - 1);
+
+  /*
+   * Write a temporary file next to the image and rename it over the image
+   * when complete, so that nobody ever maps half an image. A temporary file
+   * that is already there belongs to someone else and is not touched.
+   */
+  snprintf(tmp, sizeof(tmp), "%s.%ld", filename, (long)getpid());
+  if ((fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644)) < 0) {
+    snprintf(message, CONFIG_MESSAGE_SIZE, "Unable to create image '%.200s' "
+             "(errno %d).", tmp, errno);
+    return -1;
+  }
+  ok = (((ssize_t)sizeof(page) == write(fd, page, sizeof(page))) &&
+        ((ssize_t)sizeof(*rules) == write(fd, rules, sizeof(*rules))));
+  ok = (0 == close(fd)) && ok;
+  if (!ok || (0 != rename(tmp, filename))) {
+    snprintf(message, CONFIG_MESSAGE_SIZE, "Unable to write image '%.200s' "
+             "(errno %d).", filename, errno);
+    unlink(tmp);
+    return -1;
+  }
+
+  debug("Wrote image '%s'", filename);
+
+  return 0;
+}
+
+
+void image_delete(m2m_rules *rules) {
+  if (NULL != rules) {
+    munmap((char *)rules - IMAGE_HEADER_SIZE, IMAGE_SIZE);
+  }
+}
@@ -0,0 +1,85 @@
+/*
+ * image.h
+ *
+ * Copyright (C)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * About
+ * -----
+ *
+ * Author: AiO <aio at aio dot nu>
+ *
+ * Simple API for compiled rule images. An image is a page of header,
+ * telling which configuration file it was compiled from, followed by the
+ * rule set exactly as the translation engine uses it, so it is memory
+ * mapped rather than read. It is mapped read-only, so all of its pages are
+ * shared by all processes mapping the same image.
+ *
+ */
+
+#ifndef _IMAGE_H_
+#define _IMAGE_H_
+
+#include "m2m.h"
+#include "config.h"
+
+/*
+ * Version of the image format, images of any other version are rebuilt.
+ */
+#define IMAGE_VERSION 2
+
+
+/*
+ * Allocate an empty rule set that is not backed by any image, to be
+ * filled in by config_load() and freed with image_delete().
+ */
+m2m_rules *image_new();
+
+
+/*
+ * Map the image filename compiled from the configuration file source. The
+ * port name is stored in port_name, which must hold 255 characters, and
+ * the capabilities of the rules are added to capabilities. Returns NULL if
+ * the image is missing, of another version or build, or older than the
+ * configuration file.
+ */
+m2m_rules *image_load(const char *filename,
+                      const char *source,
+                      char *port_name,
+                      capability *capabilities);
+
+
+/*
+ * Write the rules compiled from the configuration file source to the image
+ * filename. The image is replaced atomically, so running instances keep
+ * their mapping of the old one. Returns 0 on success, or -1 with the
+ * problem described in message, which must hold CONFIG_MESSAGE_SIZE
+ * characters.
+ */
+int image_save(const char *filename,
+               const char *source,
+               const m2m_rules *rules,
+               const char *port_name,
+               capability capabilities,
+               char *message);
+
+
+/*
+ * Unmap or free a rule set from image_new() or image_load().
+ */
+void image_delete(m2m_rules *rules);
+
+#endif /* _IMAGE_H_ */
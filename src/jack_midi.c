@@ -0,0 +1,218 @@
+/*
+ * jack_midi.c
+ *
+ * Copyright (C)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * About
+ * -----
+ *
+ * Author: AiO <aio at aio dot nu>
+ *
+ * This is a simplified implementation of a Jack client with one MIDI input
+ * and one MIDI output port, translating events inside the Jack process
+ * callback.
+ *
+ */
+
+#ifdef USE_JACK
+
+#include <stdlib.h>
+#include <jack/jack.h>
+#include <jack/midiport.h>
+#include <alsa/asoundlib.h>
+
+#include "debug.h"
+#include "error.h"
+#include "midi_stream.h"
+#include "jack_transport.h"
+#include "jack_midi.h"
+
+struct jack_midi {
+  jack_client_t *client;
+  jack_port_t *in_port;
+  jack_port_t *out_port;
+  jack_transport *transport;
+  jack_midi_translate translate;
+  void *arg;
+  rcu *rcu;
+  int reader;
+  midi_stream_parser parser;
+  midi_stream_encoder encoder;
+};
+
+
+static void jack_midi_shutdown(void *arg) {
+  debug("Jack died", arg);
+}
+
+
+/*
+ * Translate one Jack MIDI event and write the result at the same frame
+ * offset, so the output is sample accurate.
+ */
+static void jack_midi_event(jack_midi *jm,
+                            void *out,
+                            jack_midi_event_t *jev) {
+  snd_seq_event_t ev;
+  unsigned char buf[3];
+  size_t len;
+  size_t i;
+
+  /*
+   * SysEx is never translated, only filtered, so it is passed on as is
+   * rather than being split up by the parser.
+   */
+  if ((jev->size > 0) && (0xF0 == jev->buffer[0])) {
+    snd_seq_ev_clear(&ev);
+    snd_seq_ev_set_sysex(&ev, jev->size, jev->buffer);
+    if (jm->translate(&ev, jm->arg)) {
+      jack_midi_event_write(out, jev->time, jev->buffer, jev->size);
+    }
+    return;
+  }
+
+  for (i = 0; i < jev->size; i++) {
+    if (0 == midi_stream_parse(&jm->parser, jev->buffer[i], &ev)) {
+      continue;
+    }
+    if (0 == jm->translate(&ev, jm->arg)) {
+      continue;
+    }
+    /*
+     * A translation can make a SysEx message of a short one, like a MIDI
+     * Machine Control command, and it is written as it is.
+     */
+    if (SND_SEQ_EVENT_SYSEX == ev.type) {
+      jack_midi_event_write(out, jev->time, ev.data.ext.ptr,
+                            ev.data.ext.len);
+      continue;
+    }
+    /*
+     * Every Jack MIDI event must carry its own status byte.
+     */
+    midi_stream_encoder_init(&jm->encoder);
+    len = midi_stream_encode(&jm->encoder, &ev, buf, sizeof(buf));
+    if (0 != len) {
+      jack_midi_event_write(out, jev->time, buf, len);
+    }
+  }
+}
+
+
+/*
+ * The Jack process callback, no locks and no allocations in here.
+ */
+static int jack_midi_process(jack_nframes_t nframes, void *arg) {
+  jack_midi *jm = (jack_midi *)arg;
+  void *in = jack_port_get_buffer(jm->in_port, nframes);
+  void *out = jack_port_get_buffer(jm->out_port, nframes);
+  uint32_t count = jack_midi_get_event_count(in);
+  uint32_t i;
+
+  jack_midi_clear_buffer(out);
+  jack_transport_update(jm->transport, nframes);
+
+  if (NULL != jm->rcu) {
+    rcu_online(jm->rcu, jm->reader);
+  }
+
+  for (i = 0; i < count; i++) {
+    jack_midi_event_t jev;
+
+    if (0 == jack_midi_event_get(&jev, in, i)) {
+      jack_midi_event(jm, out, &jev);
+    }
+  }
+
+  if (NULL != jm->rcu) {
+    rcu_offline(jm->rcu, jm->reader);
+  }
+
+  return 0;
+}
+
+
+/*
+ * Allocate a new Jack client with MIDI ports.
+ */
+jack_midi *jack_midi_new(const char *app_name,
+                         jack_midi_translate translate,
+                         void *arg,
+                         rcu *r) {
+  jack_midi *jm = malloc(sizeof(jack_midi));
+
+  if (NULL == jm) {
+    error("Could not allocate Jack MIDI client '%s'.", app_name);
+  }
+
+  jm->translate = translate;
+  jm->arg = arg;
+  jm->rcu = r;
+  jm->reader = (NULL != r) ? rcu_register(r) : -1;
+  midi_stream_parser_init(&jm->parser);
+  midi_stream_encoder_init(&jm->encoder);
+
+  if (!(jm->client = jack_client_open(app_name, JackNoStartServer, NULL))) {
+    error("Could not connect to the jack server as '%s'.", app_name);
+  }
+
+  jm->in_port = jack_port_register(jm->client, "In", JACK_DEFAULT_MIDI_TYPE,
+                                   JackPortIsInput, 0);
+  jm->out_port = jack_port_register(jm->client, "Out",
+                                    JACK_DEFAULT_MIDI_TYPE,
+                                    JackPortIsOutput, 0);
+  if ((NULL == jm->in_port) || (NULL == jm->out_port)) {
+    error("Could not register Jack MIDI ports for '%s'.", app_name);
+  }
+
+  jack_on_shutdown(jm->client, jack_midi_shutdown, 0);
+  jm->transport = jack_transport_attach(jm->client);
+  jack_set_process_callback(jm->client, jack_midi_process, jm);
+
+  return jm;
+}
+
+
+/*
+ * Get the Jack transport of the client.
+ */
+jack_transport *jack_midi_transport(jack_midi *jm) {
+  return jm->transport;
+}
+
+
+/*
+ * Start processing MIDI.
+ */
+void jack_midi_activate(jack_midi *jm) {
+  if (0 != jack_activate(jm->client)) {
+    error("Could not activate the Jack MIDI client%c", '.');
+  }
+}
+
+
+/*
+ * Clean up the Jack client.
+ */
+void jack_midi_delete(jack_midi *jm) {
+  jack_deactivate(jm->client);
+  jack_transport_delete(jm->transport);
+  jack_client_close(jm->client);
+  free(jm);
+}
+
+#endif
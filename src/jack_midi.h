@@ -0,0 +1,81 @@
+/*
+ * jack_midi.h
+ *
+ * Copyright (C)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * About
+ * -----
+ *
+ * Author: AiO <aio at aio dot nu>
+ *
+ * This is a simplified API for a Jack client with one MIDI input and one
+ * MIDI output port, translating events inside the Jack process callback.
+ *
+ */
+
+#ifndef _JACK_MIDI_H_
+#define _JACK_MIDI_H_
+
+#ifdef USE_JACK
+
+#include <jack/jack.h>
+#include <alsa/asoundlib.h>
+#include "rcu.h"
+#include "jack_transport.h"
+
+/*
+ * Translation callback run for every incoming event in the Jack process
+ * thread. It must not block nor allocate memory. Returns 1 if the (possibly
+ * modified) event should be written to the output port.
+ */
+typedef int (*jack_midi_translate)(snd_seq_event_t *ev, void *arg);
+
+typedef struct jack_midi jack_midi;
+
+
+/*
+ * Allocate a new Jack client with "In" and "Out" MIDI ports. The client is
+ * not activated until jack_midi_activate() is called. When r is not NULL
+ * the process thread is a reader of it, online during each cycle.
+ */
+jack_midi *jack_midi_new(const char *app_name,
+                         jack_midi_translate translate,
+                         void *arg,
+                         rcu *r);
+
+
+/*
+ * Get the Jack transport of the client, its snapshot is refreshed in the
+ * process callback.
+ */
+jack_transport *jack_midi_transport(jack_midi *jm);
+
+
+/*
+ * Start processing MIDI.
+ */
+void jack_midi_activate(jack_midi *jm);
+
+
+/*
+ * Clean up the Jack client.
+ */
+void jack_midi_delete(jack_midi *jm);
+
+#endif
+
+#endif /* _JACK_MIDI_H_ */
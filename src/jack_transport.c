@@ -23,56 +23,171 @@
  * Author: AiO <aio at aio dot nu>
  *
  * This is a simplified implementation for allocating resources and
- * initialise a Jack transport interface.
+ * initialise a Jack transport interface. The snapshot is published with a
+ * sequence counter that is odd while it is written, readers retry until
+ * they have read it between two equal even values. Commands go through a
+ * bounded queue where every slot has a sequence number telling if it is
+ * free or filled, so any number of threads can post to the single worker.
+ * Jog wheel ticks are only added up, and the worker turns what has added
+ * up into one locate per interval.
  *
  */
 
 #ifdef USE_JACK
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
 #include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
 #include <jack/jack.h>
 #include <jack/transport.h>
 
 #include "debug.h"
 #include "error.h"
+#include "timestamp.h"
 #include "jack_transport.h"
 
+/*
+ * Number of commands that can be waiting for the worker, a power of two.
+ */
+#define JACK_TRANSPORT_QUEUE_SIZE 64
+
+/*
+ * A locate or start asked for by the worker is assumed to have taken
+ * effect when the snapshot has been refreshed this many times since.
+ */
+#define JACK_TRANSPORT_SETTLE_CYCLES 2
+
+typedef struct {
+  jack_transport_state_t state;
+  jack_nframes_t frame;
+  jack_nframes_t frame_rate;
+  jack_nframes_t period;
+  double bpm;
+  uint64_t cycle;
+} jack_transport_snapshot;
+
+typedef struct {
+  size_t sequence;
+  jack_transport_command command;
+  char value;
+} jack_transport_slot;
+
+struct jack_transport {
+  jack_client_t *client;
+  int own_client;
+
+  /*
+   * Written by the Jack process thread.
+   */
+  unsigned int sequence;
+  jack_transport_snapshot snapshot;
+
+  /*
+   * Written by the threads sending commands.
+   */
+  size_t head;
+  uint64_t dropped;
+  long wheel;
+  jack_transport_slot slots[JACK_TRANSPORT_QUEUE_SIZE];
+
+  /*
+   * Only used by the worker thread.
+   */
+  size_t tail;
+  int pending;
+  jack_transport_snapshot requested;
+  uint64_t wheel_interval;
+  int wheel_acceleration;
+  uint64_t wheel_last;
+  int fd;
+  int timer_fd;
+  int stop;
+  pthread_t thread;
+};
+
 static void jack_shutdown(void *arg) {
   debug("Jack died", arg);
 }
 
-static void jack_reposition(jack_client_t *jack_client, double sec) {
-  jack_nframes_t frame=rint(jack_get_sample_rate(jack_client) * sec);
-  jack_transport_locate(jack_client, frame);
+
+/*
+ * Wake the worker thread up.
+ */
+static void jack_transport_wake(jack_transport *t) {
+  uint64_t one = 1;
+
+  if (write(t->fd, &one, sizeof(one)) < 0) {
+    /*
+     * The counter is already at its maximum, so a wake-up is pending.
+     */
+    return;
+  }
 }
 
-static double jack_get_position(jack_client_t *jack_client) {
-  jack_position_t jack_position;
-  double          jack_time;
 
-  /*
-   * Calculate frame.
-   */
-  jack_transport_query(jack_client, &jack_position);
-  jack_time = jack_position.frame / (double) jack_position.frame_rate;
+/*
+ * Get a consistent copy of the snapshot, with what the worker asked for
+ * in place of what the snapshot does not show yet.
+ */
+static void jack_transport_read(jack_transport *t,
+                                jack_transport_snapshot *snapshot) {
+  unsigned int before, after;
+
+  do {
+    before = __atomic_load_n(&t->sequence, __ATOMIC_ACQUIRE);
+    *snapshot = t->snapshot;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    after = __atomic_load_n(&t->sequence, __ATOMIC_RELAXED);
+  } while ((before & 1) || (before != after));
+
+  if ((1 == t->pending) &&
+      (snapshot->cycle <= t->requested.cycle + JACK_TRANSPORT_SETTLE_CYCLES)) {
+    snapshot->state = t->requested.state;
+    snapshot->frame = t->requested.frame;
+  }
+  else {
+    t->pending = 0;
+  }
+}
+
 
-  return(jack_time);
+/*
+ * Remember what the worker asked for, until the snapshot shows it.
+ */
+static void jack_transport_request(jack_transport *t,
+                                   const jack_transport_snapshot *snapshot) {
+  t->requested = *snapshot;
+  t->pending = 1;
 }
 
-static double jack_get_bpm(jack_client_t *jack_client) {
-  jack_position_t tpos;
-  jack_transport_query(jack_client, &tpos);
+static void jack_reposition(jack_transport *t,
+                            jack_transport_snapshot *snapshot,
+                            double sec) {
+  jack_nframes_t frame = rint(snapshot->frame_rate * sec);
+  jack_transport_locate(t->client, frame);
+  snapshot->frame = frame;
+  jack_transport_request(t, snapshot);
+}
 
-  if (tpos.valid & JackPositionBBT) {
-    return tpos.beats_per_minute;
-  }
-  return 120.0;
+static double jack_get_position(const jack_transport_snapshot *snapshot) {
+  /*
+   * Calculate frame.
+   */
+  return snapshot->frame / (double)snapshot->frame_rate;
 }
 
-static double jack_prev_beat(jack_client_t *jack_client) {
-  double position = jack_get_position(jack_client);
-  double bpm = jack_get_bpm(jack_client);
+static double jack_prev_beat(const jack_transport_snapshot *snapshot) {
+  double position = jack_get_position(snapshot);
+  double bpm = snapshot->bpm;
   int beats = ceil(bpm * ((position - 0.1) / 60.0)) - 1;
   double prev_beat_position = (double)beats / bpm * 60.0;
   if (prev_beat_position < 0) {
@@ -81,17 +196,18 @@ static double jack_prev_beat(jack_client_t *jack_client) {
   return prev_beat_position;
 }
 
-static double jack_next_beat(jack_client_t *jack_client) {
-  double position = jack_get_position(jack_client);
-  double bpm = jack_get_bpm(jack_client);
+static double jack_next_beat(const jack_transport_snapshot *snapshot) {
+  double position = jack_get_position(snapshot);
+  double bpm = snapshot->bpm;
   int beats = floor(bpm * ((position + 0.1) / 60.0)) + 1;
   double next_beat_position = (double)beats / bpm * 60.0;
   return next_beat_position;
 }
 
-static double jack_move_partial_beat(jack_client_t *jack_client, int count) {
-  double position = jack_get_position(jack_client);
-  double bpm = jack_get_bpm(jack_client);
+static double jack_move_partial_beat(const jack_transport_snapshot *snapshot,
+                                     double count) {
+  double position = jack_get_position(snapshot);
+  double bpm = snapshot->bpm;
   double beats = bpm * (position / 60.0) + 0.0625 * count;
   double new_position = beats / bpm * 60.0;
   if (new_position < 0) {
@@ -100,39 +216,33 @@ static double jack_move_partial_beat(jack_client_t *jack_client, int count) {
   return new_position;
 }
 
-jack_client_t *jack_transport_new(const char *app_name) {
-  jack_client_t *jack_client;
 
-  /*
-   * Initiate as a jack client.
-   *
-   * TODO: Use jack2 jack_client_open() instead, since jack_client_new()
-   *       is depricated.
-   */
-  if (!(jack_client = jack_client_new(app_name))) {
-    error("Could not connect to the jack server as '%s'.", app_name);
-  }
-  jack_on_shutdown(jack_client, jack_shutdown, 0);
-  jack_activate(jack_client);
+/*
+ * Carry out one command, on the worker thread.
+ */
+static void jack_transport_run(jack_transport *t,
+                               jack_transport_command command,
+                               char value) {
+  jack_transport_snapshot snapshot;
 
-  return jack_client;
-}
+  jack_transport_read(t, &snapshot);
 
-void jack_transport_send(jack_client_t *jack_client,
-                         jack_transport_command command,
-                         char value) {
   switch (command) {
   case JT_PLAY:
     /*
      * If jack is rolling, the PLAY will be PAUSE
      */
-    switch (jack_transport_query(jack_client, NULL)) {
+    switch (snapshot.state) {
     case JackTransportRolling:
-      jack_transport_stop(jack_client);
+      jack_transport_stop(t->client);
+      snapshot.state = JackTransportStopped;
+      jack_transport_request(t, &snapshot);
       debug("Jack transport paused (%d)", value);
       break;
     case JackTransportStopped:
-      jack_transport_start(jack_client);
+      jack_transport_start(t->client);
+      snapshot.state = JackTransportRolling;
+      jack_transport_request(t, &snapshot);
       debug("Jack transport playing (%d)", value);
       break;
     default:
@@ -140,22 +250,24 @@ void jack_transport_send(jack_client_t *jack_client,
     }
     break;
   case JT_STOP:
-    switch (jack_transport_query(jack_client, NULL)) {
+    switch (snapshot.state) {
     case JackTransportRolling:
       /*
        * If jack is rolling, the STOP will be PAUSE
        */
-      jack_transport_stop(jack_client);
+      jack_transport_stop(t->client);
+      snapshot.state = JackTransportStopped;
+      jack_transport_request(t, &snapshot);
       debug("Jack transport paused (%d)", value);
       break;
     case JackTransportStopped:
       /*
        * If jack is rolling, the STOP will be stop at the beginning
        */
-      jack_reposition(jack_client, 0);
-      jack_transport_start(jack_client);
-      jack_transport_stop(jack_client);
-      jack_reposition(jack_client, 0);
+      jack_reposition(t, &snapshot, 0);
+      jack_transport_start(t->client);
+      jack_transport_stop(t->client);
+      jack_reposition(t, &snapshot, 0);
       debug("Jack transport rewinded (%d)", value);
       break;
     default:
@@ -163,20 +275,13 @@ void jack_transport_send(jack_client_t *jack_client,
     }
     break;
   case JT_REV:
-    jack_reposition(jack_client, jack_prev_beat(jack_client));
+    jack_reposition(t, &snapshot, jack_prev_beat(&snapshot));
     debug("Jack transport previous beat (%d)", value);
     break;
   case JT_FWD:
-    jack_reposition(jack_client, jack_next_beat(jack_client));
+    jack_reposition(t, &snapshot, jack_next_beat(&snapshot));
     debug("Jack transport next beat (%d)", value);
     break;
-  case JT_WHEEL:
-    if (value > 64) {
-      value = (128 - value) * -1;
-    }
-    jack_reposition(jack_client, jack_move_partial_beat(jack_client, value));
-    debug("Jack transport jog wheel value %d", value);
-    break;
   default:
     break;
   }
@@ -184,9 +289,276 @@ void jack_transport_send(jack_client_t *jack_client,
 }
 
 
-void jack_transport_delete(jack_client_t *jack_client) {
-  jack_deactivate(jack_client);
-  jack_client_close(jack_client);
+/*
+ * Take the oldest command from the queue, returns 0 if it is empty.
+ */
+static int jack_transport_take(jack_transport *t,
+                               jack_transport_command *command,
+                               char *value) {
+  jack_transport_slot *slot =
+    &t->slots[t->tail & (JACK_TRANSPORT_QUEUE_SIZE - 1)];
+
+  if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != t->tail + 1) {
+    return 0;
+  }
+
+  *command = slot->command;
+  *value = slot->value;
+  __atomic_store_n(&slot->sequence, t->tail + JACK_TRANSPORT_QUEUE_SIZE,
+                   __ATOMIC_RELEASE);
+  t->tail++;
+
+  return 1;
+}
+
+
+/*
+ * Move by the jog wheel ticks that have added up, at most once per
+ * interval. Before the interval is over the timer is set for when it is,
+ * so that the worker can carry out commands in the meantime. The more
+ * ticks there are the longer every step is, by the acceleration in percent
+ * per extra tick.
+ */
+static void jack_transport_scrub(jack_transport *t) {
+  jack_transport_snapshot snapshot;
+  uint64_t interval, due;
+  double steps;
+  long ticks;
+
+  if (0 == __atomic_load_n(&t->wheel, __ATOMIC_RELAXED)) {
+    return;
+  }
+
+  jack_transport_read(t, &snapshot);
+  interval = t->wheel_interval;
+  if ((0 == interval) && (0 != snapshot.frame_rate)) {
+    interval = (uint64_t)snapshot.period * 1000000000ULL /
+      snapshot.frame_rate;
+  }
+
+  due = t->wheel_last + interval;
+  if (timestamp_now() < due) {
+    struct itimerspec its = { { 0, 0 }, { 0, 0 } };
+    its.it_value.tv_sec = due / 1000000000ULL;
+    its.it_value.tv_nsec = due % 1000000000ULL;
+    timerfd_settime(t->timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+    return;
+  }
+
+  ticks = __atomic_exchange_n(&t->wheel, 0, __ATOMIC_RELAXED);
+  if (0 == ticks) {
+    return;
+  }
+  steps = ticks * (1.0 + t->wheel_acceleration * (labs(ticks) - 1) / 100.0);
+
+  jack_transport_read(t, &snapshot);
+  jack_reposition(t, &snapshot, jack_move_partial_beat(&snapshot, steps));
+  t->wheel_last = timestamp_now();
+  debug("Jack transport jog wheel %ld ticks, %.1f steps", ticks, steps);
+}
+
+
+static void *jack_transport_worker(void *arg) {
+  jack_transport *t = (jack_transport *)arg;
+
+  while (1) {
+    struct pollfd pfd[2];
+    jack_transport_command command;
+    uint64_t count;
+    char value;
+
+    /*
+     * Woken up by a command or by the jog wheel timer.
+     */
+    pfd[0].fd = t->fd;
+    pfd[1].fd = t->timer_fd;
+    pfd[0].events = pfd[1].events = POLLIN;
+    if (poll(pfd, 2, -1) < 0) {
+      continue;
+    }
+    if ((0 != (pfd[0].revents & POLLIN)) &&
+        (read(t->fd, &count, sizeof(count)) < 0)) {
+      continue;
+    }
+    if ((0 != (pfd[1].revents & POLLIN)) &&
+        (read(t->timer_fd, &count, sizeof(count)) < 0)) {
+      continue;
+    }
+    if (__atomic_load_n(&t->stop, __ATOMIC_ACQUIRE)) {
+      break;
+    }
+
+    while (jack_transport_take(t, &command, &value)) {
+      jack_transport_run(t, command, value);
+    }
+    jack_transport_scrub(t);
+  }
+
+  return NULL;
+}
+
+
+/*
+ * The process callback of a client of its own.
+ */
+static int jack_transport_process(jack_nframes_t nframes, void *arg) {
+  jack_transport_update((jack_transport *)arg, nframes);
+
+  return 0;
+}
+
+
+jack_transport *jack_transport_attach(jack_client_t *jack_client) {
+  jack_transport *t;
+  size_t i;
+
+  if (NULL == (t = calloc(1, sizeof(jack_transport)))) {
+    error("Could not allocate the Jack transport%c", '.');
+  }
+
+  t->client = jack_client;
+  for (i = 0; i < JACK_TRANSPORT_QUEUE_SIZE; i++) {
+    t->slots[i].sequence = i;
+  }
+
+  /*
+   * Start with a snapshot from before the first cycle.
+   */
+  jack_transport_update(t, 0);
+
+  if ((t->fd = eventfd(0, EFD_CLOEXEC)) < 0) {
+    error("Could not create a Jack transport eventfd (errno %d).", errno);
+  }
+  if ((t->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC)) < 0) {
+    error("Could not create a Jack transport timerfd (errno %d).", errno);
+  }
+
+  if (0 != pthread_create(&t->thread, NULL, jack_transport_worker, t)) {
+    error("Could not start the Jack transport thread%c", '.');
+  }
+
+  return t;
+}
+
+
+jack_transport *jack_transport_new(const char *app_name) {
+  jack_client_t *jack_client;
+  jack_transport *t;
+
+  /*
+   * Initiate as a jack client.
+   *
+   * TODO: Use jack2 jack_client_open() instead, since jack_client_new()
+   *       is depricated.
+   */
+  if (!(jack_client = jack_client_new(app_name))) {
+    error("Could not connect to the jack server as '%s'.", app_name);
+  }
+  jack_on_shutdown(jack_client, jack_shutdown, 0);
+
+  t = jack_transport_attach(jack_client);
+  t->own_client = 1;
+
+  jack_set_process_callback(jack_client, jack_transport_process, t);
+  jack_activate(jack_client);
+
+  return t;
+}
+
+
+void jack_transport_wheel(jack_transport *t,
+                          int interval_usecs,
+                          int acceleration) {
+  t->wheel_interval = (uint64_t)interval_usecs * 1000;
+  t->wheel_acceleration = acceleration;
+}
+
+
+void jack_transport_update(jack_transport *t, jack_nframes_t nframes) {
+  jack_position_t position;
+  jack_transport_state_t state = jack_transport_query(t->client, &position);
+  unsigned int sequence = __atomic_load_n(&t->sequence, __ATOMIC_RELAXED);
+
+  __atomic_store_n(&t->sequence, sequence + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  t->snapshot.state = state;
+  t->snapshot.frame = position.frame;
+  t->snapshot.frame_rate = position.frame_rate;
+  t->snapshot.period = nframes;
+  t->snapshot.bpm = (position.valid & JackPositionBBT) ?
+    position.beats_per_minute : 120.0;
+  t->snapshot.cycle++;
+
+  __atomic_store_n(&t->sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+
+void jack_transport_send(jack_transport *t,
+                         jack_transport_command command,
+                         char value) {
+  size_t head = __atomic_load_n(&t->head, __ATOMIC_RELAXED);
+  jack_transport_slot *slot;
+
+  /*
+   * Jog wheel ticks are added up rather than queued, only the first one
+   * since the worker last took them needs to wake it up.
+   */
+  if (JT_WHEEL == command) {
+    long ticks = (value > 64) ? value - 128 : value;
+    if (0 == __atomic_fetch_add(&t->wheel, ticks, __ATOMIC_RELAXED)) {
+      jack_transport_wake(t);
+    }
+    return;
+  }
+
+  while (1) {
+    size_t sequence;
+
+    slot = &t->slots[head & (JACK_TRANSPORT_QUEUE_SIZE - 1)];
+    sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+    if (sequence == head) {
+      if (__atomic_compare_exchange_n(&t->head, &head, head + 1, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        break;
+      }
+    }
+    else if ((long)(sequence - head) < 0) {
+      /*
+       * The worker is this far behind, the transport can not keep up.
+       */
+      __atomic_add_fetch(&t->dropped, 1, __ATOMIC_RELAXED);
+      return;
+    }
+    else {
+      head = __atomic_load_n(&t->head, __ATOMIC_RELAXED);
+    }
+  }
+
+  slot->command = command;
+  slot->value = value;
+  __atomic_store_n(&slot->sequence, head + 1, __ATOMIC_RELEASE);
+
+  jack_transport_wake(t);
+}
+
+
+void jack_transport_delete(jack_transport *t) {
+  __atomic_store_n(&t->stop, 1, __ATOMIC_RELEASE);
+  jack_transport_wake(t);
+  pthread_join(t->thread, NULL);
+  close(t->fd);
+  close(t->timer_fd);
+
+  if (0 != t->dropped) {
+    debug("Dropped %lu Jack transport commands", (unsigned long)t->dropped);
+  }
+
+  if (1 == t->own_client) {
+    jack_deactivate(t->client);
+    jack_client_close(t->client);
+  }
+  free(t);
 }
 
 #endif
@@ -23,7 +23,10 @@
  * Author: AiO <aio at aio dot nu>
  *
  * This is a simplified API for allocating resources and initialise a Jack
- * transport interface
+ * transport interface. The transport state is kept in a snapshot that the
+ * Jack process callback refreshes every cycle, and commands are carried
+ * out by a worker thread, so sending one never waits for the Jack server.
+ * Jog wheel ticks are added up and applied as one locate at a time.
  *
  */
 
@@ -43,25 +46,55 @@ typedef enum {
   JT_UNKNOWN
 } jack_transport_command;
 
+typedef struct jack_transport jack_transport;
+
 
 /*
  * Allocate a new Jack client and register callbacks.
  */
-jack_client_t *jack_transport_new(const char *app_name);
+jack_transport *jack_transport_new(const char *app_name);
+
+
+/*
+ * Control the transport with a Jack client that has a process callback of
+ * its own, which must call jack_transport_update() every cycle. The client
+ * is not closed by jack_transport_delete().
+ */
+jack_transport *jack_transport_attach(jack_client_t *jack_client);
+
+
+/*
+ * Set how often the jog wheel may locate, in microseconds (0 for once per
+ * Jack period), and how much longer every step gets per tick added up in
+ * that time, in percent (0 to move the same distance per tick). Call it
+ * before any command is sent.
+ */
+void jack_transport_wheel(jack_transport *transport,
+                          int interval_usecs,
+                          int acceleration);
+
+
+/*
+ * Refresh the transport snapshot, with the number of frames in the cycle.
+ * This is called from the Jack process callback and is realtime safe.
+ */
+void jack_transport_update(jack_transport *transport, jack_nframes_t nframes);
 
 
 /*
- * Send a translation value to jack transport.
+ * Send a translation value to jack transport. The command is queued for
+ * the worker thread without locks, from any thread, and dropped if the
+ * queue is full.
  */
-void jack_transport_send(jack_client_t *jack_client,
+void jack_transport_send(jack_transport *transport,
                          jack_transport_command command,
                          char value);
 
 
 /*
- * Clean up a jack client.
+ * Clean up a jack transport, and its client if it has one of its own.
  */
-void jack_transport_delete(jack_client_t *jack_client);
+void jack_transport_delete(jack_transport *transport);
 
 #endif
 
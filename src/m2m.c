@@ -0,0 +1,670 @@
+/*
+ * m2m.c
+ *
+ * Copyright (C)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * About
+ * -----
+ *
+ * Author: AiO <aio at aio dot nu>
+ *
+ * Implementation of the midi2midi translation engine.
+ *
+ */
+
+#include <string.h>
+#include <alsa/asoundlib.h>
+
+#include "m2m.h"
+
+
+/*
+ * Check if an event type is among the filtered message types.
+ */
+static int m2m_filtered(message_type filter, snd_seq_event_type_t type) {
+  switch (type) {
+    case SND_SEQ_EVENT_NOTE: {
+      return 0 != (filter & (MT_NOTE_ON | MT_NOTE_OFF));
+    }
+    case SND_SEQ_EVENT_NOTEON: {
+      return 0 != (filter & MT_NOTE_ON);
+    }
+    case SND_SEQ_EVENT_NOTEOFF: {
+      return 0 != (filter & MT_NOTE_OFF);
+    }
+    case SND_SEQ_EVENT_KEYPRESS: {
+      return 0 != (filter & MT_POLYPHONIC_KEY_PRESSURE);
+    }
+    case SND_SEQ_EVENT_CONTROLLER: {
+      return 0 != (filter & MT_CONTROL_CHANGE);
+    }
+    case SND_SEQ_EVENT_PGMCHANGE: {
+      return 0 != (filter & MT_PROGRAM_CHANGE);
+    }
+    case SND_SEQ_EVENT_CHANPRESS: {
+      return 0 != (filter & MT_CHANNEL_PRESSURE);
+    }
+    case SND_SEQ_EVENT_PITCHBEND: {
+      return 0 != (filter & MT_PITCH_BEND_CHANGE);
+    }
+    case SND_SEQ_EVENT_SYSEX: {
+      return 0 != (filter & MT_SYSEX);
+    }
+    case SND_SEQ_EVENT_QFRAME: {
+      return 0 != (filter & MT_MIDI_TIME_CODE_QUARTER_FRAME);
+    }
+    case SND_SEQ_EVENT_SONGPOS: {
+      return 0 != (filter & MT_SONG_POSITION_POINTER);
+    }
+    case SND_SEQ_EVENT_SONGSEL: {
+      return 0 != (filter & MT_SONG_SELECT);
+    }
+    case SND_SEQ_EVENT_TUNE_REQUEST: {
+      return 0 != (filter & MT_TUNE_REQUEST);
+    }
+    case SND_SEQ_EVENT_CLOCK:
+    case SND_SEQ_EVENT_TICK: {
+      return 0 != (filter & MT_TIMING_CLOCK);
+    }
+    case SND_SEQ_EVENT_START:
+    case SND_SEQ_EVENT_STOP:
+    case SND_SEQ_EVENT_CONTINUE: {
+      return 0 != (filter & MT_MMC);
+    }
+    default: {
+      return 0;
+    }
+  }
+}
+
+
+void m2m_rules_init(m2m_rules *rules) {
+  int ch, i;
+
+  memset(rules, 0, sizeof(*rules));
+  rules->nvelocity_maps = 1;
+
+  for (ch = 0; ch < 16; ch++) {
+    for (i = 0; i < 128; i++) {
+      rules->note_table[ch][i].type = rules->cc_table[ch][i].type = TT_NONE;
+      rules->note_table[ch][i].value = rules->cc_table[ch][i].value = i;
+      rules->note_table[ch][i].channel = rules->cc_table[ch][i].channel = -1;
+    }
+  }
+}
+
+
+void m2m_options_init(m2m_options *options,
+                      message_type filter,
+                      int suppress) {
+  int type;
+
+  options->filter = filter;
+  options->suppress = suppress;
+
+  for (type = 0; type < 256; type++) {
+    unsigned char action = M2M_PASS;
+
+    if (m2m_filtered(filter, type)) {
+      action = M2M_DROP;
+    }
+    else if ((SND_SEQ_EVENT_NOTEON == type) ||
+             (SND_SEQ_EVENT_NOTEOFF == type)) {
+      action = M2M_NOTE;
+    }
+    else if (SND_SEQ_EVENT_CONTROLLER == type) {
+      action = M2M_CC;
+    }
+    options->action[type] = action;
+  }
+}
+
+
+/*
+ * Find or build the MIDI Machine Control message for a command and device
+ * ID. Returns its index in the rule set, or -1 if it is full.
+ */
+static int m2m_mmc_frame_add(m2m_rules *rules, int command, int device) {
+  m2m_mmc_frame frame;
+  int i;
+
+  frame.length = 0;
+  frame.data[frame.length++] = 0xF0;
+  frame.data[frame.length++] = 0x7F;
+  frame.data[frame.length++] = device;
+  frame.data[frame.length++] = 0x06;
+  frame.data[frame.length++] = command;
+  if (M2M_MMC_LOCATE == command) {
+    /*
+     * Locate to a target given as hours (with the frame rate bits), minutes,
+     * seconds, frames and subframes, all zero.
+     */
+    frame.data[frame.length++] = 0x06;
+    frame.data[frame.length++] = 0x01;
+    for (i = 0; i < 5; i++) {
+      frame.data[frame.length++] = 0x00;
+    }
+  }
+  frame.data[frame.length++] = 0xF7;
+  memset(&frame.data[frame.length], 0, sizeof(frame.data) - frame.length);
+
+  for (i = 0; i < rules->nmmc_frames; i++) {
+    if (0 == memcmp(&rules->mmc_frames[i], &frame, sizeof(frame))) {
+      return i;
+    }
+  }
+  if (M2M_MAX_MMC_FRAMES == rules->nmmc_frames) {
+    return -1;
+  }
+  rules->mmc_frames[rules->nmmc_frames] = frame;
+
+  return rules->nmmc_frames++;
+}
+
+
+m2m_result m2m_rule_add(m2m_rules *rules,
+                        translation_type type,
+                        int source_channel,
+                        int from,
+                        int to,
+                        int channel) {
+  translation (*table)[128];
+  translation t;
+  int ch;
+
+  if ((-1 != source_channel) &&
+      ((1 > source_channel) || (16 < source_channel))) {
+    return M2M_INVALID_SOURCE_CHANNEL;
+  }
+  if ((0 > from) || (127 < from)) {
+    return M2M_INVALID_FROM;
+  }
+  if ((0 > to) || (127 < to)) {
+    return M2M_INVALID_TO;
+  }
+  if (TT_NOTE_TO_MMC == type) {
+    if ((M2M_MMC_STOP > to) ||
+        ((M2M_MMC_REWIND < to) && (M2M_MMC_LOCATE != to))) {
+      return M2M_INVALID_TO;
+    }
+    if ((-1 > channel) || (127 < channel)) {
+      return M2M_INVALID_CHANNEL;
+    }
+    to = m2m_mmc_frame_add(rules, to,
+                           (-1 == channel) ? M2M_MMC_ALL_DEVICES : channel);
+    if (0 > to) {
+      return M2M_FULL;
+    }
+    channel = -1;
+  }
+  else if ((-1 != channel) && ((1 > channel) || (16 < channel))) {
+    return M2M_INVALID_CHANNEL;
+  }
+
+  switch (type) {
+    case TT_NOTE_TO_NOTE:
+    case TT_NOTE_TO_CC:
+    case TT_NOTE_TO_JACK:
+    case TT_NOTE_TO_MMC: {
+      table = rules->note_table;
+      break;
+    }
+    case TT_CC_TO_CC:
+    case TT_CC_TO_NOTE: {
+      table = rules->cc_table;
+      break;
+    }
+    default: {
+      return M2M_INVALID_TYPE;
+    }
+  }
+
+  t.type = type;
+  t.value = to;
+  t.channel = (-1 == channel) ? -1 : channel - 1;
+  t.flags = (-1 == source_channel) ? M2M_ANY_CHANNEL : 0;
+  t.velocity = 0;
+
+  if (-1 != source_channel) {
+    translation *entry = &table[source_channel - 1][from];
+    if ((TT_NONE != entry->type) &&
+        (M2M_ANY_CHANNEL != (entry->flags & M2M_ANY_CHANNEL))) {
+      return M2M_DUPLICATE;
+    }
+    *entry = t;
+    return M2M_OK;
+  }
+
+  /*
+   * A rule for any channel fills in every channel without a rule of its
+   * own.
+   */
+  for (ch = 0; ch < 16; ch++) {
+    if (M2M_ANY_CHANNEL == (table[ch][from].flags & M2M_ANY_CHANNEL)) {
+      return M2M_DUPLICATE;
+    }
+  }
+  for (ch = 0; ch < 16; ch++) {
+    if (TT_NONE == table[ch][from].type) {
+      table[ch][from] = t;
+    }
+  }
+
+  return M2M_OK;
+}
+
+
+/*
+ * Count the note table entries using a velocity map.
+ */
+static int m2m_velocity_map_users(const m2m_rules *rules, int index) {
+  int users = 0;
+  int ch, i;
+
+  for (ch = 0; ch < 16; ch++) {
+    for (i = 0; i < 128; i++) {
+      users += (index == rules->note_table[ch][i].velocity);
+    }
+  }
+
+  return users;
+}
+
+
+m2m_result m2m_rule_layer(m2m_rules *rules,
+                          translation_type type,
+                          int source_channel,
+                          int from,
+                          int low,
+                          int high,
+                          int to,
+                          const unsigned char curve[128]) {
+  translation *entries[16];
+  m2m_velocity_map next;
+  int nentries = 0;
+  int index, ch, v, i;
+
+  if ((TT_NOTE_TO_NOTE != type) && (TT_NOTE_TO_CC != type)) {
+    return M2M_INVALID_TYPE;
+  }
+  if ((-1 != source_channel) &&
+      ((1 > source_channel) || (16 < source_channel))) {
+    return M2M_INVALID_SOURCE_CHANNEL;
+  }
+  if ((0 > from) || (127 < from)) {
+    return M2M_INVALID_FROM;
+  }
+  if ((0 > to) || (127 < to)) {
+    return M2M_INVALID_TO;
+  }
+  if ((1 > low) || (low > high) || (127 < high)) {
+    return M2M_INVALID_VELOCITY;
+  }
+
+  /*
+   * Find the entries of the rule, a rule for any channel is in every
+   * channel without a rule of its own.
+   */
+  for (ch = 0; ch < 16; ch++) {
+    translation *entry = &rules->note_table[ch][from];
+    if ((-1 == source_channel) ?
+        (M2M_ANY_CHANNEL == (entry->flags & M2M_ANY_CHANNEL)) :
+        ((ch == source_channel - 1) &&
+         (M2M_ANY_CHANNEL != (entry->flags & M2M_ANY_CHANNEL)))) {
+      if (type != entry->type) {
+        return M2M_INVALID_TYPE;
+      }
+      entries[nentries++] = entry;
+    }
+  }
+  if (0 == nentries) {
+    return M2M_OK;
+  }
+
+  /*
+   * All entries of a rule share one map, the new layer is added to a copy
+   * of it, which starts out sending the value of the rule with an
+   * unchanged velocity.
+   */
+  index = entries[0]->velocity;
+  if (0 == index) {
+    for (v = 0; v < 128; v++) {
+      next.value[v] = 0;
+      next.velocity[v] = v;
+    }
+  }
+  else {
+    next = rules->velocity_maps[index];
+  }
+  for (v = low; v <= high; v++) {
+    next.value[v] = to - entries[0]->value;
+    next.velocity[v] = (NULL != curve) ? curve[v] : v;
+  }
+
+  /*
+   * Use an identical map if there is one, otherwise change the old map if
+   * no other rule uses it, or add a new one.
+   */
+  for (i = 1; i < rules->nvelocity_maps; i++) {
+    if (0 == memcmp(&rules->velocity_maps[i], &next, sizeof(next))) {
+      break;
+    }
+  }
+  if ((i == rules->nvelocity_maps) &&
+      ((0 == index) || (nentries != m2m_velocity_map_users(rules, index)))) {
+    if (M2M_MAX_VELOCITY_MAPS == rules->nvelocity_maps) {
+      return M2M_FULL;
+    }
+    rules->nvelocity_maps++;
+  }
+  else if (i == rules->nvelocity_maps) {
+    i = index;
+  }
+  rules->velocity_maps[i] = next;
+  for (ch = 0; ch < nentries; ch++) {
+    entries[ch]->velocity = i;
+  }
+
+  return M2M_OK;
+}
+
+
+void m2m_state_init(m2m_state *state,
+                    const m2m_options *options,
+                    m2m_cache *cache) {
+  memset(state->sounding, 0, sizeof(state->sounding));
+  state->options = options;
+  state->cache = cache;
+}
+
+
+void m2m_cache_init(m2m_cache *cache) {
+  memset(cache, 0xff, sizeof(*cache));
+}
+
+
+/*
+ * Translate a note on or off according to the note table, to value with
+ * velocity.
+ */
+static int m2m_note(const m2m_rules *rules,
+                    const translation *t,
+                    int value,
+                    int velocity,
+                    const snd_seq_event_t *in,
+                    snd_seq_event_t *out) {
+  switch (t->type) {
+    case TT_NONE: {
+      break;
+    }
+    case TT_NOTE_TO_NOTE: {
+      if (0 <= t->channel) {
+        out->data.note.channel = t->channel;
+      }
+      out->data.note.note = value;
+      out->data.note.velocity = velocity;
+      break;
+    }
+    case TT_NOTE_TO_CC: {
+      /*
+       * Map the note to a parameter id and the velocity to the value.
+       */
+      out->type = SND_SEQ_EVENT_CONTROLLER;
+      out->data.control.channel = (0 <= t->channel) ?
+        t->channel : in->data.note.channel;
+      out->data.control.param = value;
+      out->data.control.value = velocity;
+      break;
+    }
+    case TT_NOTE_TO_JACK: {
+      out->type = M2M_EVENT_JACK_TRANSPORT;
+      out->data.control.param = t->value;
+      out->data.control.value = in->data.note.velocity;
+      break;
+    }
+    case TT_NOTE_TO_MMC: {
+      /*
+       * Only a note on starts a command, the message is sent as it was
+       * built with the rule.
+       */
+      const m2m_mmc_frame *frame = &rules->mmc_frames[value];
+      if ((SND_SEQ_EVENT_NOTEON != in->type) || (0 == velocity)) {
+        return 0;
+      }
+      snd_seq_ev_set_sysex(out, frame->length, (void *)frame->data);
+      break;
+    }
+    default: {
+      /*
+       * Translations that are not implemented yet consume the note.
+       */
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+
+/*
+ * Translate a MIDI Continuous Controller according to the CC table.
+ */
+static int m2m_cc(const translation *t,
+                  const snd_seq_event_t *in,
+                  snd_seq_event_t *out) {
+  switch (t->type) {
+    case TT_NONE: {
+      break;
+    }
+    case TT_CC_TO_CC: {
+      if (0 <= t->channel) {
+        out->data.control.channel = t->channel;
+      }
+      out->data.control.param = t->value;
+      break;
+    }
+    case TT_CC_TO_NOTE: {
+      /*
+       * Map the controller to a note and the value to the velocity, a
+       * value of 0 is a note off.
+       */
+      out->type = in->data.control.value ?
+        SND_SEQ_EVENT_NOTEON : SND_SEQ_EVENT_NOTEOFF;
+      out->data.note.channel = (0 <= t->channel) ?
+        t->channel : in->data.control.channel;
+      out->data.note.note = t->value;
+      out->data.note.velocity = in->data.control.value;
+      out->data.note.off_velocity = 0;
+      out->data.note.duration = 0;
+      break;
+    }
+    default: {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+
+/*
+ * Remember what an outgoing event changes in the receiver. Returns 0 if
+ * it changes nothing and is of a kind to suppress. Data entry, (N)RPN
+ * selection and channel mode messages are a sequence or an action rather
+ * than a state, and always get through.
+ */
+static int m2m_cache_update(m2m_cache *cache,
+                            int suppress,
+                            const snd_seq_event_t *ev) {
+  int channel = ev->data.control.channel & 0x0f;
+
+  switch (ev->type) {
+    case SND_SEQ_EVENT_CONTROLLER: {
+      int param = ev->data.control.param & 0x7f;
+      unsigned char value = ev->data.control.value & 0x7f;
+      if ((6 == param) || (38 == param) ||
+          ((96 <= param) && (101 >= param)) || (120 <= param)) {
+        if (121 == param) {
+          /*
+           * Reset All Controllers, what they are reset to is up to the
+           * receiver.
+           */
+          memset(cache->cc[channel], 0xff, sizeof(cache->cc[channel]));
+          cache->bend[channel] = 0xffff;
+          cache->pressure[channel] = 0xff;
+        }
+        return 1;
+      }
+      if (value == cache->cc[channel][param]) {
+        return (0 == (suppress & M2M_SUPPRESS_CC));
+      }
+      cache->cc[channel][param] = value;
+      if ((0 == param) || (32 == param)) {
+        cache->bank_changed[channel] = 1;
+      }
+      return 1;
+    }
+    case SND_SEQ_EVENT_PGMCHANGE: {
+      unsigned char value = ev->data.control.value & 0x7f;
+      if ((value == cache->program[channel]) &&
+          (0 == cache->bank_changed[channel])) {
+        return (0 == (suppress & M2M_SUPPRESS_PROGRAM));
+      }
+      cache->program[channel] = value;
+      cache->bank_changed[channel] = 0;
+      return 1;
+    }
+    case SND_SEQ_EVENT_PITCHBEND: {
+      unsigned short value = (ev->data.control.value + 8192) & 0x3fff;
+      if (value == cache->bend[channel]) {
+        return (0 == (suppress & M2M_SUPPRESS_BEND));
+      }
+      cache->bend[channel] = value;
+      return 1;
+    }
+    case SND_SEQ_EVENT_CHANPRESS: {
+      unsigned char value = ev->data.control.value & 0x7f;
+      if (value == cache->pressure[channel]) {
+        return (0 == (suppress & M2M_SUPPRESS_PRESSURE));
+      }
+      cache->pressure[channel] = value;
+      return 1;
+    }
+    case SND_SEQ_EVENT_RESET: {
+      m2m_cache_init(cache);
+      return 1;
+    }
+    default: {
+      return 1;
+    }
+  }
+}
+
+
+/*
+ * Filter and translate one event, without looking at the receiver.
+ */
+static int m2m_translate_event(const m2m_rules *rules,
+                               m2m_state *state,
+                               const snd_seq_event_t *in,
+                               snd_seq_event_t *out,
+                               int size,
+                               translation_type *applied) {
+  const translation *t;
+
+  *applied = TT_NONE;
+
+  if (1 > size) {
+    return 0;
+  }
+
+  switch (state->options->action[in->type]) {
+    case M2M_PASS: {
+      *out = *in;
+      return 1;
+    }
+    case M2M_NOTE: {
+      translation *sounding = &state->sounding[in->data.note.channel & 0x0f]
+                                              [in->data.note.note & 0x7f];
+      int velocity = in->data.note.velocity & 0x7f;
+      int value;
+      t = &rules->note_table[in->data.note.channel & 0x0f]
+                            [in->data.note.note & 0x7f];
+      value = t->value;
+      if ((SND_SEQ_EVENT_NOTEON == in->type) && (0 < velocity)) {
+        /*
+         * Remember how the note was started, with the value from the
+         * velocity map, so that it is stopped on the same layer.
+         */
+        if (0 != t->velocity) {
+          const m2m_velocity_map *map = &rules->velocity_maps[t->velocity];
+          value += map->value[velocity];
+          velocity = map->velocity[velocity];
+        }
+        *sounding = *t;
+        sounding->value = value;
+        sounding->velocity = 0;
+        sounding->flags |= M2M_SOUNDING;
+      }
+      else if (M2M_SOUNDING == (sounding->flags & M2M_SOUNDING)) {
+        /*
+         * Stop the note the way it was started, and forget it.
+         */
+        t = sounding;
+        value = t->value;
+        sounding->flags &= ~M2M_SOUNDING;
+      }
+      *applied = t->type;
+      *out = *in;
+      return m2m_note(rules, t, value, velocity, in, out);
+    }
+    case M2M_CC: {
+      t = &rules->cc_table[in->data.control.channel & 0x0f]
+                          [in->data.control.param & 0x7f];
+      *applied = t->type;
+      *out = *in;
+      return m2m_cc(t, in, out);
+    }
+    default: {
+      return 0;
+    }
+  }
+}
+
+
+int m2m_translate(const m2m_rules *rules,
+                  m2m_state *state,
+                  const snd_seq_event_t *in,
+                  snd_seq_event_t *out,
+                  int size,
+                  translation_type *applied) {
+  int n = m2m_translate_event(rules, state, in, out, size, applied);
+  int i, kept;
+
+  if ((0 == state->options->suppress) || (NULL == state->cache)) {
+    return n;
+  }
+
+  for (i = kept = 0; i < n; i++) {
+    if (0 != m2m_cache_update(state->cache, state->options->suppress,
+                              &out[i])) {
+      out[kept++] = out[i];
+    }
+  }
+
+  return kept;
+}
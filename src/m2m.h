@@ -0,0 +1,338 @@
+/*
+ * m2m.h
+ *
+ * Copyright (C)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * About
+ * -----
+ *
+ * Author: AiO <aio at aio dot nu>
+ *
+ * The midi2midi translation engine (libmidi2midi). A rule set is built
+ * once and then only read, all mutable state of a translation lives in a
+ * separate state structure owned by the caller. Nothing here allocates
+ * memory, prints or exits, so a rule set can be shared by any number of
+ * threads as long as each state is only used by one at a time.
+ *
+ */
+
+#ifndef _M2M_H_
+#define _M2M_H_
+
+#include <alsa/asoundlib.h>
+
+/*
+ * Type definition for all the supported translations that midi2midi can
+ * perform.
+ */
+typedef enum {
+  TT_NONE,
+  TT_NOTE_TO_NOTE,
+  TT_CC_TO_CC,
+  TT_NOTE_TO_CC,
+  TT_CC_TO_NOTE,
+  TT_NOTE_TO_JACK,
+  TT_NOTE_TO_MMC
+} translation_type;
+
+#define TT_COUNT (TT_NOTE_TO_MMC + 1)
+
+/*
+ * Type definition for different message types to filter on.
+ */
+typedef enum {
+  MT_NONE = 0,
+  MT_NOTE_ON = 1,
+  MT_NOTE_OFF = 2,
+  MT_POLYPHONIC_KEY_PRESSURE = 4,
+  MT_CONTROL_CHANGE = 8,
+  MT_PROGRAM_CHANGE = 16,
+  MT_CHANNEL_PRESSURE = 32,
+  MT_PITCH_BEND_CHANGE = 64,
+  MT_CHANNEL_MODE_MESSAGES = 128,
+  MT_SYSEX = 128,
+  MT_MIDI_TIME_CODE_QUARTER_FRAME = 256,
+  MT_SONG_POSITION_POINTER = 512,
+  MT_SONG_SELECT = 1024,
+  MT_TUNE_REQUEST = 2048,
+  MT_TIMING_CLOCK = 4096,
+  MT_MMC = 8196
+} message_type;
+
+/*
+ * Results of adding a rule to a rule set.
+ */
+typedef enum {
+  M2M_OK,
+  M2M_INVALID_TYPE,
+  M2M_INVALID_SOURCE_CHANNEL,
+  M2M_INVALID_FROM,
+  M2M_INVALID_TO,
+  M2M_INVALID_CHANNEL,
+  M2M_INVALID_VELOCITY,
+  M2M_DUPLICATE,
+  M2M_FULL
+} m2m_result;
+
+/*
+ * What to do with an event, per ALSA event type.
+ */
+typedef enum {
+  M2M_PASS,
+  M2M_DROP,
+  M2M_NOTE,
+  M2M_CC
+} m2m_action;
+
+/*
+ * A note translated to a Jack transport command comes out as an event of
+ * this type, with the command in data.control.param and the velocity in
+ * data.control.value. It is up to the host to carry it out.
+ */
+#define M2M_EVENT_JACK_TRANSPORT SND_SEQ_EVENT_USR0
+
+/*
+ * Largest number of events one input event can be translated into.
+ */
+#define M2M_MAX_EVENTS 1
+
+/*
+ * Flags of a translation table entry.
+ */
+#define M2M_ANY_CHANNEL 1
+#define M2M_SOUNDING 2
+
+/*
+ * Kinds of messages to suppress when they would not change the state of
+ * the receiver. Bank select is part of M2M_SUPPRESS_CC, and a program
+ * change always gets through after a bank select that did.
+ */
+#define M2M_SUPPRESS_PROGRAM 1
+#define M2M_SUPPRESS_CC 2
+#define M2M_SUPPRESS_BEND 4
+#define M2M_SUPPRESS_PRESSURE 8
+#define M2M_SUPPRESS_ALL 15
+
+/*
+ * MIDI Machine Control commands a note can be translated to. A locate
+ * goes to the start, 00:00:00:00.
+ */
+#define M2M_MMC_STOP 1
+#define M2M_MMC_PLAY 2
+#define M2M_MMC_DEFERRED_PLAY 3
+#define M2M_MMC_FAST_FORWARD 4
+#define M2M_MMC_REWIND 5
+#define M2M_MMC_LOCATE 0x44
+
+/*
+ * The MIDI Machine Control device ID every device listens to.
+ */
+#define M2M_MMC_ALL_DEVICES 127
+
+/*
+ * Number of different MIDI Machine Control messages (command and device
+ * ID) a rule set can hold, and the size of the largest one, a locate.
+ */
+#define M2M_MAX_MMC_FRAMES 64
+#define M2M_MMC_FRAME_SIZE 13
+
+/*
+ * Number of velocity maps a rule set can hold, the first one is never used.
+ */
+#define M2M_MAX_VELOCITY_MAPS 128
+
+/*
+ * Type definition for a translation table entry, kept at five bytes so
+ * that both tables together fit in 20 KiB. The channel is the output
+ * channel 0-15, or -1 to keep the channel of the incoming event.
+ * M2M_ANY_CHANNEL is set in the flags when the entry comes from a rule
+ * that matches any source channel. A note entry with a velocity map
+ * (velocity is not 0) gets both the value and the velocity it sends from
+ * that map, indexed by the incoming velocity.
+ */
+typedef struct {
+  unsigned char type;
+  unsigned char value;
+  signed char channel;
+  unsigned char flags;
+  unsigned char velocity;
+} translation;
+
+/*
+ * Type definition for a velocity map, what to add to the value (note or
+ * controller) of the entry and the velocity to send, for every incoming
+ * velocity. Velocity curves and velocity layers are both compiled into
+ * these, and entries with the same curves and layers share one map.
+ */
+typedef struct {
+  signed char value[128];
+  unsigned char velocity[128];
+} m2m_velocity_map;
+
+/*
+ * Type definition for a complete MIDI Machine Control SysEx message, built
+ * when the rule is added so that a translation only has to point at it.
+ */
+typedef struct {
+  unsigned char length;
+  unsigned char data[M2M_MMC_FRAME_SIZE];
+} m2m_mmc_frame;
+
+/*
+ * A compiled rule set. The translations are compiled into one entry per
+ * source channel and note or MIDI Continuous Controller number. Initialise
+ * with m2m_rules_init() and add rules with m2m_rule_add(). A rule set holds
+ * nothing that changes from run to run, so it can be copied to and mapped
+ * read-only from a file as it is.
+ */
+typedef struct {
+  translation note_table[16][128];
+  translation cc_table[16][128];
+  int nvelocity_maps;
+  m2m_velocity_map velocity_maps[M2M_MAX_VELOCITY_MAPS];
+  int nmmc_frames;
+  m2m_mmc_frame mmc_frames[M2M_MAX_MMC_FRAMES];
+} m2m_rules;
+
+/*
+ * The options of a run. The filter is compiled into one action per ALSA
+ * event type, and suppress holds the M2M_SUPPRESS_* flags. Initialise with
+ * m2m_options_init().
+ */
+typedef struct {
+  unsigned char action[256];
+  message_type filter;
+  int suppress;
+} m2m_options;
+
+/*
+ * What the receiver of an output port was last sent, per channel, 0xff
+ * (0xffff for pitch bend) when it is not known. The values are kept even
+ * when they are not suppressed, and bank_changed tells if a bank select
+ * has been sent since the last program change. Initialise with
+ * m2m_cache_init(). A cache holds no pointers, so it can be kept in a
+ * file and outlive the process.
+ */
+typedef struct {
+  unsigned char program[16];
+  unsigned char bank_changed[16];
+  unsigned char pressure[16];
+  unsigned short bend[16];
+  unsigned char cc[16][128];
+} m2m_cache;
+
+/*
+ * Mutable translation state, the translation each sounding note was
+ * started with, flagged with M2M_SOUNDING, so that its note off is
+ * translated the same way even if the rule set has been replaced in
+ * between, the options to translate with and the receiver state cache of
+ * the output, if any. The options and the cache are owned by the caller.
+ * The cache is keyed by output channel, so a state with a cache must only
+ * be used by one thread at a time. Initialise with m2m_state_init().
+ */
+typedef struct {
+  translation sounding[16][128];
+  const m2m_options *options;
+  m2m_cache *cache;
+} m2m_state;
+
+
+/*
+ * Reset a rule set so that everything passes untranslated.
+ */
+void m2m_rules_init(m2m_rules *rules);
+
+
+/*
+ * Set the message types to filter and the kinds of messages (the
+ * M2M_SUPPRESS_* flags) to suppress when they would not change the state
+ * of the receiver.
+ */
+void m2m_options_init(m2m_options *options,
+                      message_type filter,
+                      int suppress);
+
+
+/*
+ * Add a rule translating from a note or MIDI Continuous Controller,
+ * depending on the type, on the source channel (1-16, or -1 for any). A
+ * rule for a specific source channel takes precedence over one for any
+ * channel, whatever order they are added in. The output channel is 1-16,
+ * or -1 to keep the source channel. For TT_NOTE_TO_JACK the to value is the
+ * Jack transport command. For TT_NOTE_TO_MMC the to value is the MIDI
+ * Machine Control command (M2M_MMC_*) and the channel is the device ID
+ * 0-127, or -1 for M2M_MMC_ALL_DEVICES.
+ */
+m2m_result m2m_rule_add(m2m_rules *rules,
+                        translation_type type,
+                        int source_channel,
+                        int from,
+                        int to,
+                        int channel);
+
+
+/*
+ * Give the notes of a rule, added with m2m_rule_add() for the same type,
+ * source channel and note, another note (to) and velocity when they are
+ * played with a velocity between low and high. The velocity is looked up
+ * in curve, or kept if curve is NULL. Several layers can be given for one
+ * rule, a later one wins where they overlap. Only note to note and note to
+ * MIDI Continuous Controller rules have layers.
+ */
+m2m_result m2m_rule_layer(m2m_rules *rules,
+                          translation_type type,
+                          int source_channel,
+                          int from,
+                          int low,
+                          int high,
+                          int to,
+                          const unsigned char curve[128]);
+
+
+/*
+ * Reset a translation state, forgetting all sounding notes, with the
+ * options to translate with and the receiver state cache to use or NULL to
+ * suppress nothing. The cache is left as it is.
+ */
+void m2m_state_init(m2m_state *state,
+                    const m2m_options *options,
+                    m2m_cache *cache);
+
+
+/*
+ * Forget everything a receiver state cache knows.
+ */
+void m2m_cache_init(m2m_cache *cache);
+
+
+/*
+ * Filter and translate one event. The resulting events, at most size of
+ * them, are written to out, which must not overlap the incoming event.
+ * Returns the number of events written, 0 if the event was filtered,
+ * consumed or suppressed. The type of translation that was applied is stored
+ * in applied.
+ * A MIDI Machine Control message is a SysEx event pointing into the rule
+ * set, so the rule set must not go away before the event is sent.
+ */
+int m2m_translate(const m2m_rules *rules,
+                  m2m_state *state,
+                  const snd_seq_event_t *in,
+                  snd_seq_event_t *out,
+                  int size,
+                  translation_type *applied);
+
+#endif /* _M2M_H_ */
@@ -0,0 +1,174 @@
+/*
+ * m2mc.c
+ *
+ * Copyright (C)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *
+ * About
+ * -----
+ *
+ * Author: AiO <aio at aio dot nu>
+ *
+ * Compiler for midi2midi configuration files. Every file is validated and
+ * compiled into a rule image next to it, which midi2midi maps at start-up
+ * instead of parsing the file.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include "error.h"
+#include "debug.h"
+#include "m2m.h"
+#include "config.h"
+#include "image.h"
+#define APPNAME "m2mc"
+#define VERSION "1.3.0"
+
+
+/*
+ * Command usage providing a simple help for the user.
+ */
+static void usage(char *app_name) {
+  printf("USAGE: %s [-hvd] [-o <image>] <file name> ...\n\n"
+         " -h, --help                   Show this help text.\n"
+         " -v, --version                Display version information.\n"
+         " -o, --output=image           Name of the image, when compiling a\n"
+         "                              single file. Default is the file name\n"
+         "                              with a 'c' appended, where midi2midi\n"
+         "                              looks for it.\n"
+         " -d, --debug                  Output debug information.\n"
+         "\n"
+         "Validates midi2midi configuration files and compiles them into\n"
+         "rule images that midi2midi maps at start-up, instead of reading\n"
+         "the files. An image older than its file is rebuilt by midi2midi.\n"
+         "\n"
+         "Author: AiO\n", app_name);
+}
+
+
+/*
+ * Compile one configuration file, returns 0 on success.
+ */
+static int m2mc(const char *filename, const char *image_name) {
+  char port_name[255];
+  char message[CONFIG_MESSAGE_SIZE];
+  capability capabilities = CB_NONE;
+  m2m_rules *rules;
+  int retval;
+
+  if (NULL == (rules = image_new())) {
+    error("Could not allocate a rule set%c", '.');
+  }
+
+#ifdef USE_JACK
+  retval = config_load(filename, rules, port_name, &capabilities, message, 1);
+#else
+  retval = config_load(filename, rules, port_name, &capabilities, message);
+#endif
+  if (0 == retval) {
+    retval = image_save(image_name, filename, rules, port_name, capabilities,
+                        message);
+  }
+  if (0 != retval) {
+    fprintf(stderr, "%s\n", message);
+  }
+
+  image_delete(rules);
+
+  return retval;
+}
+
+
+/*
+ * Main function of m2mc.
+ */
+int main(int argc, char *argv[]) {
+  char *output = NULL;
+  int failures = 0;
+  int i;
+
+  static struct option long_options[] = {
+    {"help", no_argument, NULL, 'h'},
+    {"version", no_argument, NULL, 'v'},
+    {"output", required_argument, NULL, 'o'},
+    {"debug", no_argument, NULL,  'd'},
+    {0, 0, 0,  0 }
+  };
+
+  while (1) {
+    int option_index = 0;
+    int c = getopt_long(argc, argv, "hv?o:d", long_options, &option_index);
+    if (c == -1) {
+      break;
+    }
+
+    switch (c) {
+      case '?':
+      case 'h': {
+        usage(argv[0]);
+        exit(EXIT_SUCCESS);
+        break;
+      }
+      case 'v': {
+        printf("%s %s", APPNAME, VERSION);
+        exit(EXIT_SUCCESS);
+        break;
+      }
+      case 'o': {
+        output = optarg;
+        break;
+      }
+      case 'd': {
+        debug_enable();
+        break;
+      }
+      default: {
+        error("Unknown parameter %c.", c);
+        break;
+      }
+    }
+  }
+
+  if (optind == argc) {
+    error("No configuration file was provided, use %s -h for more "
+          "information.", APPNAME);
+  }
+
+  if ((NULL != output) && (optind + 1 != argc)) {
+    error("An image name can only be given for a single file%c", '.');
+  }
+
+  for (i = optind; i < argc; i++) {
+    char image_name[4096];
+
+    if (NULL != output) {
+      snprintf(image_name, sizeof(image_name), "%s", output);
+    }
+    else {
+      snprintf(image_name, sizeof(image_name), "%sc", argv[i]);
+    }
+    if (0 != m2mc(argv[i], image_name)) {
+      failures++;
+    }
+  }
+
+  exit((0 == failures) ? EXIT_SUCCESS : EXIT_FAILURE);
+
+  return 0;
+}
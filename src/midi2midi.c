@@ -37,8 +37,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <getopt.h>
-#include <signal.h>
 #include <unistd.h>
+#include <signal.h>
+#include <errno.h>
 #include <alsa/asoundlib.h>
 #ifdef USE_JACK
 #include <jack/jack.h>
@@ -47,13 +48,64 @@
 #include "error.h"
 #include "debug.h"
 #include "quit.h"
+#include "event_loop.h"
 #include "sequencer.h"
+#include "rawmidi.h"
+#include "midi_stream.h"
+#include "pipeline.h"
+#include "timestamp.h"
+#include "realtime.h"
+#include "histogram.h"
+#include "replay.h"
+#include "m2m.h"
+#include "config.h"
+#include "image.h"
+#include "rcu.h"
+#include "reload.h"
+#include "thin.h"
+#include "outq.h"
+#include "cache.h"
 #ifdef USE_JACK
 #include "jack_transport.h"
+#include "jack_midi.h"
 #endif
 #define APPNAME "midi2midi"
 #define VERSION "1.3.0"
 
+/*
+ * Default maximum number of events buffered before draining when batched
+ * output is enabled without an explicit size.
+ */
+#define BATCH_DEFAULT_SIZE 32
+
+/*
+ * Largest number of events that can be buffered in one batch.
+ */
+#define BATCH_MAX_SIZE 256
+
+/*
+ * Default number of events an output queue holds when output queueing is
+ * enabled without an explicit size.
+ */
+#define QUEUE_DEFAULT_SIZE 256
+
+/*
+ * Sizes of the byte buffers used by the rawmidi backend. The output buffer
+ * must hold at least one complete SysEx chunk.
+ */
+#define RAWMIDI_IN_BUFFER_SIZE 256
+#define RAWMIDI_OUT_BUFFER_SIZE 1024
+
+/*
+ * Maximum number of configuration files one process can host.
+ */
+#define MAX_INSTANCES 64
+
+/*
+ * A replay is repeated until it has run for at least this many nanoseconds.
+ */
+#define REPLAY_MIN_TIME 1000000000ULL
+
 
 /*
  * Set this variable to 1 to exit the main loop cleanly.
@@ -62,465 +114,758 @@ static int quit = 0;
 
 
 /*
- * Type definition for all the supported translations that midi2midi can
- * perform.
+ * Set this variable to 1 to time-stamp every event when it is read and to
+ * record how long it took until it was written.
  */
-typedef enum {
-  TT_NONE,
-  TT_NOTE_TO_NOTE,
-  TT_CC_TO_CC,
-  TT_NOTE_TO_CC,
-  TT_CC_TO_NOTE,
-#ifdef USE_JACK
-  TT_NOTE_TO_JACK,
-#endif
-  TT_NOTE_TO_MMC
-} translation_type;
+static int measure_latency = 0;
 
 
 /*
- * Type definition for keeping track of the needed resource capabilities
- * for the running instance of this program.
+ * Number of times the input of the sequencer client overran and the
+ * sequencer threw away what was waiting to be read.
  */
-typedef enum {
-  CB_NONE = 0,
-  CB_ALSA_MIDI_IN = 1,
-  CB_ALSA_MIDI_OUT = 2,
-#ifdef USE_JACK
-  CB_JACK_TRANSPORT_OUT = 4
-#endif
-} capability;
+static uint64_t input_overruns = 0;
+
 
 /*
- * Type definition for different message types to filter on.
+ * Identifiers for the file descriptor sources of the main loop.
  */
 typedef enum {
-  MT_NONE = 0,
-  MT_NOTE_ON = 1,
-  MT_NOTE_OFF = 2,
-  MT_POLYPHONIC_KEY_PRESSURE = 4,
-  MT_CONTROL_CHANGE = 8,
-  MT_PROGRAM_CHANGE = 16,
-  MT_CHANNEL_PRESSURE = 32,
-  MT_PITCH_BEND_CHANGE = 64,
-  MT_CHANNEL_MODE_MESSAGES = 128,
-  MT_SYSEX = 128,
-  MT_MIDI_TIME_CODE_QUARTER_FRAME = 256,
-  MT_SONG_POSITION_POINTER = 512,
-  MT_SONG_SELECT = 1024,
-  MT_TUNE_REQUEST = 2048,
-  MT_TIMING_CLOCK = 4096,
-  MT_MMC = 8196
-} message_type;
+  SOURCE_SEQUENCER,
+  SOURCE_RAWMIDI,
+  SOURCE_SIGNAL
+} source;
+
+
+/*
+ * Type definition for batched MIDI output. When size is 0 every event is
+ * written directly to the sequencer, otherwise events are buffered and
+ * drained when the poll wake-up is done, when size events are pending or
+ * when the oldest pending event is older than age nanoseconds (0 = no age
+ * limit). The latency of the pending events is recorded when they are
+ * drained.
+ */
+typedef struct {
+  int size;
+  uint64_t age;
+  int pending;
+  uint64_t first;
+  uint64_t ingress[BATCH_MAX_SIZE];
+  histogram *latency[BATCH_MAX_SIZE];
+} output_batch;
+
 
 /*
- * Type definition for a translation table entry.
+ * Type definition for one translation instance, that is one configuration
+ * file with its own translation rules and state and its own pair of MIDI
+ * ports. Port numbers are -1 when the port is not needed. When latency is
+ * measured there is one histogram per translation type for the output port,
+ * when continuous data is thinned out there is a thinner for it and when
+ * output is queued there is an output queue for the output port. Events
+ * the sequencer refused to take from the output port are counted in lost.
+ * The rules are replaced as a whole when the configuration is reloaded, so
+ * they must only be read through instance_rules().
  */
 typedef struct {
-  translation_type type;
-  char value;
-  char last_value;
-  char channel;
-  int line;
-} translation;
+  char *config_file;
+  char port_name[255];
+  m2m_rules *rules;
+  m2m_state state;
+  int in_port;
+  int out_port;
+  histogram *latency;
+  thin *thin;
+  outq *queue;
+  uint64_t lost;
+} instance;
+
+
+/*
+ * Everything the reload thread needs to replace the rules of all
+ * instances.
+ */
+typedef struct {
+  instance *instances;
+  int ninstances;
+  capability capabilities;
+  rcu *rcu;
+#ifdef USE_JACK
+  int use_jack;
+#endif
+} reload_context;
+
+
+/*
+ * Get the current rules of an instance. The pointer stays valid until the
+ * calling thread goes offline or announces a quiescent state.
+ */
+static const m2m_rules *instance_rules(const instance *inst) {
+  return __atomic_load_n(&inst->rules, __ATOMIC_ACQUIRE);
+}
 
 
 /*
  * Command usage providing a simple help for the user.
  */
 static void usage(char *app_name) {
-  printf("USAGE: %s [-c <file name>] [-n <client_name>] [-hvpd] [-f \n\n"
+  printf("USAGE: %s [-c <file name> ...] [-n <client_name>] [-hvpd] [-f <what>]\n"
+         "       [-b [<events>[,<usecs>]]] [-r [<priority>]] [-a <cpu>]\n"
+         "       [-i <rawmidi device> -o <rawmidi device>]\n"
+         "       [-T <threads>[,port|channel]] [-l] [-R <file>] [-C]\n"
+         "       [-t <what>:<rate>[,<delta>] ...]\n"
+         "       [-q [<events>[,supersede|oldest|newest]]]\n"
+         "       [-s [<what>,...]] [-S <file>]\n"
+         "       [-P <events>] [-B <bytes>[,<bytes>]]\n\n"
          " -h, --help                   Show this help text.\n"
          " -v, --version                Display version information.\n"
          " -c, --config=file            Note translation configuration file\n"
          "                              to load. See manual for file format.\n"
+         "                              Give it several times to host one port\n"
+         "                              pair per file in a single ALSA client.\n"
          " -n, --client-name=name       Name of the client. This\n"
          "                              overrides line 2 in the config file.\n"
          " -p, --program-repeat-prevent Prevent a program select on a MIDI\n"
          "                              device to repeated times.\n"
          " -f, --filter         <what>  Filter all specified MIDI message types.\n"
+         " -b, --batch[=events[,usecs]] Buffer translated events and write them\n"
+         "                              with one drain per wake-up, at most\n"
+         "                              <events> (default 32) at a time and\n"
+         "                              never holding one longer than <usecs>.\n"
+         " -r, --realtime[=priority]    Run the event loop with SCHED_FIFO\n"
+         "                              (default priority 40) and locked memory.\n"
+         " -a, --cpu=cpu                Pin the event loop to a CPU (with -r).\n"
+         " -i, --rawmidi-in=device      Read directly from a rawmidi device\n"
+         "                              (e.g. hw:1,0,0) instead of the sequencer.\n"
+         " -o, --rawmidi-out=device     Write directly to a rawmidi device.\n"
+         " -T, --threads=n[,port|channel]\n"
+         "                              Translate on n worker threads, sharding\n"
+         "                              the input by input port (default) or by\n"
+         "                              input port and channel.\n"
+         " -l, --latency                Measure the time every event spends in\n"
+         "                              midi2midi. The percentiles are printed\n"
+         "                              on SIGUSR1 and at exit.\n"
+         " -R, --replay=file            Translate a recorded standard MIDI file\n"
+         "                              or raw MIDI dump as fast as possible,\n"
+         "                              report the throughput and exit.\n"
+         " -C, --check                  Check the configuration files, report\n"
+         "                              every error with its line and column\n"
+         "                              and exit.\n"
+         " -t, --thin=what:rate[,delta] Thin out continuous data (cc, bend,\n"
+         "                              pressure or all) to at most <rate>\n"
+         "                              values per second per controller and\n"
+         "                              channel, changing at least <delta>.\n"
+         "                              The last value always gets through.\n"
+         " -q, --queue[=events[,drop]]  Never block on a full output, queue at\n"
+         "                              most <events> (default 256) per port,\n"
+         "                              urgent first. When full, drop superseded\n"
+         "                              values (supersede, default), the oldest\n"
+         "                              or the newest event.\n"
+         " -s, --suppress[=what,...]    Suppress messages that would not change\n"
+         "                              the receiver (program, cc, bend,\n"
+         "                              pressure or all, the default).\n"
+         " -S, --state-file=file        Remember what the receivers were sent\n"
+         "                              in a file, across restarts. Implies\n"
+         "                              -s all when -s is not given.\n",
+         app_name);
 #ifdef USE_JACK
-         " -j, --jack                   Use Jack-specific fatures.\n"
+  printf(" -j, --jack                   Use Jack-specific fatures.\n"
+         " -J, --jack-midi              Use Jack MIDI ports instead of ALSA and\n"
+         "                              translate in the Jack process callback.\n"
+         " -w, --wheel=msecs[,accel]    Locate at most every <msecs> (default\n"
+         "                              every Jack period) with the jog wheel,\n"
+         "                              steps <accel> percent longer for every\n"
+         "                              tick more in that time.\n");
 #endif
+  printf(" -P, --pool=events            Size of the sequencer client input and\n"
+         "                              output pools, in events.\n"
+         " -B, --buffers=in[,out]       Size of the sequencer input and output\n"
+         "                              buffers, in bytes. Input overruns and\n"
+         "                              lost events are printed on SIGUSR1.\n"
          " -d, --debug                  Output debug information.\n"
          "\n"
          "This tool is a useful MIDI proxy if you own studio equipment that\n"
          "will not speak to each other the way you want to. Just route your\n"
          "MIDI signals through an instance of this and make magic happen!\n"
          "\n"
-         "Author: AiO\n", app_name);
+         "Send SIGHUP to reload the configuration files while running.\n"
+         "\n"
+         "Author: AiO\n");
 }
 
 
 /*
- * Signal handler callback routine, basically just make the program exit
- * in a nice and proper way.
+ * Human readable name of a translation type, used in the latency report.
  */
-static void quit_callback(int sig) {
-  signal(sig, quit_callback);
-  debug("DEBUG: Quitting with signal %d", sig);
-  quit = 1;
+static const char *translation_type_name(translation_type type) {
+  switch (type) {
+    case TT_NONE: return "untranslated";
+    case TT_NOTE_TO_NOTE: return "note to note";
+    case TT_CC_TO_CC: return "cc to cc";
+    case TT_NOTE_TO_CC: return "note to cc";
+    case TT_CC_TO_NOTE: return "cc to note";
+    case TT_NOTE_TO_JACK: return "note to jack";
+    case TT_NOTE_TO_MMC: return "note to mmc";
+  }
+  return "unknown";
 }
 
 
 /*
- * Parse the specified configuration file and construct translation tables
- * for both MIDI notes and MIDI Continuous Controls.
+ * The ingress time-stamp of an event is kept in its time field, which is
+ * not used for the direct delivery midi2midi does. This way it follows the
+ * event through batches and the worker threads.
  */
-#ifdef USE_JACK
-static capability translation_table_init(const char *filename,
-                                         translation note_table[255],
-                                         translation cc_table[255],
-                                         char *port_name,
-                                         capability capabilities,
-                                         int use_jack) {
-#else
-static capability translation_table_init(const char *filename,
-                                         translation note_table[255],
-                                         translation cc_table[255],
-                                         char *port_name,
-                                         capability capabilities) {
-#endif
-  FILE *fd;
-  int line_number = 0;
-  int i;
+static void latency_stamp(snd_seq_event_t *ev, uint64_t now) {
+  ev->time.time.tv_sec = (unsigned int)(now >> 32);
+  ev->time.time.tv_nsec = (unsigned int)(now & 0xffffffff);
+}
 
-  /*
-   * Just set the translation tables for both notes and MIDI Continuous
-   * Controls to defaults.
-   */
-  for (i = 0; i < 255; i++) {
-    cc_table[i].type = note_table[i].type = TT_NONE;
-    cc_table[i].value = note_table[i].value = i;
-    cc_table[i].last_value = note_table[i].last_value = -1;
-    cc_table[i].channel = note_table[i].channel = -1;
+
+static uint64_t latency_ingress(const snd_seq_event_t *ev) {
+  return ((uint64_t)ev->time.time.tv_sec << 32) | ev->time.time.tv_nsec;
+}
+
+
+/*
+ * Get the histogram an event translated by an instance is recorded in, or
+ * NULL if latency is not measured.
+ */
+static histogram *latency_histogram(instance *inst, translation_type type) {
+  if ((NULL == inst) || (NULL == inst->latency)) {
+    return NULL;
   }
+  return &inst->latency[type];
+}
 
-  if (NULL == filename) {
-    return capabilities;
+
+/*
+ * Record the time from ingress until now.
+ */
+static void latency_record(histogram *h, uint64_t ingress) {
+  if (NULL != h) {
+    histogram_record(h, timestamp_now() - ingress);
   }
+}
 
-  /*
-   * Open the specified configuration file.
-   */
-  if ((fd = fopen(filename, "r")) == NULL) {
-    error("Unable to open file '%s'.", filename);
+
+/*
+ * Print one line of the latency report, in microseconds.
+ */
+static void latency_report_line(const char *name, const histogram *h) {
+  if (0 == histogram_count(h)) {
+    return;
   }
+  printf("  %-20s %10llu %9.1f %9.1f %9.1f %9.1f\n",
+         name,
+         (unsigned long long)histogram_count(h),
+         histogram_percentile(h, 0.5) / 1000.0,
+         histogram_percentile(h, 0.99) / 1000.0,
+         histogram_percentile(h, 0.999) / 1000.0,
+         histogram_max(h) / 1000.0);
+}
 
-  debug("Reading file '%s'", filename);
 
-  /*
-   * Read each line of the configuration file and assign notes accordingly.
-   */
-  while (!feof(fd)) {
-    int from, to, channel;
-    char c;
-    errno = 0;
-    line_number++;
-
-     /*
-     * Parse the current line. First line is the file version, the second
-     * line is the name of the MIDI-port to use and the rest is the actual
-     * MIDI note conversion table definition.
-     */
-    if (1 == line_number) {
-      /*
-       * Make sure that we can handle the file version :)
-       */
-      fscanf(fd, "midi2midi-config-1.3\n");
+/*
+ * Print the latency percentiles per output and per translation type. This
+ * only reads the histograms, so it is fine to do while events flow.
+ */
+static void latency_report(instance *instances, int ninstances) {
+  static histogram total, type_total[TT_COUNT];
+  int i, type;
 
-      if (errno != 0) {
-        debug("The file '%s' was no 1.3 file, trying 1.2", filename);
+  histogram_init(&total);
+  for (type = 0; type < TT_COUNT; type++) {
+    histogram_init(&type_total[type]);
+  }
 
-        /*
-         * Just to be sure, start over.
-         */
-        fscanf(fd, "midi2midi-config-1.2\n");
-        if (errno != 0) {
-          debug("The file '%s' was no 1.2 file, trying 1.1", filename);
+  printf("Latency (usecs)             events       p50       p99      p999"
+         "       max\n");
+  for (i = 0; i < ninstances; i++) {
+    static histogram output;
+    histogram_init(&output);
+    printf("%s\n", instances[i].port_name);
+    for (type = 0; type < TT_COUNT; type++) {
+      latency_report_line(translation_type_name(type),
+                          &instances[i].latency[type]);
+      histogram_add(&output, &instances[i].latency[type]);
+      histogram_add(&type_total[type], &instances[i].latency[type]);
+    }
+    latency_report_line("all", &output);
+    histogram_add(&total, &output);
+  }
+  if (1 < ninstances) {
+    printf("All outputs\n");
+    for (type = 0; type < TT_COUNT; type++) {
+      latency_report_line(translation_type_name(type), &type_total[type]);
+    }
+    latency_report_line("all", &total);
+  }
+  fflush(stdout);
+}
 
-          /*
-           * Just to be sure, start over.
-           */
-          rewind(fd);
 
-          fscanf(fd, "midi2midi-config-1.1\n");
+/*
+ * Print how many events of every kind of continuous data were thinned out.
+ */
+static void thin_report(instance *instances, int ninstances) {
+  static const char *names[THIN_TYPES] = {
+    "controllers", "pitch bend", "pressure"
+  };
+  int i, type;
+
+  printf("Thinning                    events      sent     saved\n");
+  for (i = 0; i < ninstances; i++) {
+    printf("%s\n", instances[i].port_name);
+    for (type = 0; type < THIN_TYPES; type++) {
+      uint64_t received, sent;
+      thin_counts(instances[i].thin, type, &received, &sent);
+      if (0 != received) {
+        printf("  %-20s %10llu %9llu %8.1f%%\n",
+               names[type],
+               (unsigned long long)received,
+               (unsigned long long)sent,
+               (received - sent) * 100.0 / received);
+      }
+    }
+  }
+}
 
-          if (errno != 0) {
-            debug("The file '%s' was no 1.1 file, trying 1.0", filename);
 
-            /*
-             * Just to be sure, start over.
-             */
-            rewind(fd);
+/*
+ * Print how many times the input overran, how many events the sequencer
+ * says were lost on the way in and how many could not be written to each
+ * output port.
+ */
+static void overrun_report(snd_seq_t *seq_handle,
+                           instance *instances,
+                           int ninstances) {
+  int lost = sequencer_lost(seq_handle);
+  int i;
 
-            /*
-             * We can also handle 1.0 configuration files.
-             */
-            fscanf(fd, "midi2midi-config-1.0\n");
+  printf("Overruns                    events\n");
+  printf("  %-20s %10llu\n", "input overruns",
+         (unsigned long long)input_overruns);
+  if (0 <= lost) {
+    printf("  %-20s %10d\n", "input lost", lost);
+  }
+  for (i = 0; i < ninstances; i++) {
+    printf("%s\n", instances[i].port_name);
+    printf("  %-20s %10llu\n", "output lost",
+           (unsigned long long)__atomic_load_n(&instances[i].lost,
+                                               __ATOMIC_RELAXED));
+  }
+  fflush(stdout);
+}
 
-            if (errno != 0) {
-              error("The file '%s' is not a midi2midi configuration file.",
-                    filename);
-            }
-          }
-        }
-      }
-      continue;
+
+/*
+ * Write all buffered MIDI events to the sequencer in one go.
+ */
+static void batch_flush(snd_seq_t *seq_handle, output_batch *batch) {
+  int i;
+
+  if (0 == batch->pending) {
+    return;
+  }
+
+  trace("Draining %d batched events", batch->pending);
+
+  snd_seq_drain_output(seq_handle);
+  for (i = 0; i < batch->pending; i++) {
+    latency_record(batch->latency[i], batch->ingress[i]);
+  }
+  batch->pending = 0;
+}
+
+
+/*
+ * Buffer a MIDI event for output and drain the buffer if the batch has
+ * reached its size or age limit. Returns a negative error code if the
+ * event could not be buffered.
+ */
+static int batch_output(snd_seq_t *seq_handle,
+                        output_batch *batch,
+                        snd_seq_event_t *ev,
+                        histogram *latency) {
+  if ((0 == batch->pending) && (0 != batch->age)) {
+    batch->first = timestamp_now();
+  }
+
+  if (0 > snd_seq_event_output(seq_handle, ev)) {
+    return -1;
+  }
+  batch->ingress[batch->pending] = latency_ingress(ev);
+  batch->latency[batch->pending] = latency;
+  batch->pending++;
+
+  if ((batch->pending >= batch->size) ||
+      ((0 != batch->age) && (timestamp_now() - batch->first >= batch->age))) {
+    batch_flush(seq_handle, batch);
+  }
+
+  return 0;
+}
+
+/*
+ * Print what happened to the events of every output queue.
+ */
+static void queue_report(instance *instances, int ninstances) {
+  static const char *names[OUTQ_LANES] = {
+    "urgent", "notes", "controllers"
+  };
+  int i, lane;
+
+  printf("Output queue                queued      sent superseded   dropped\n");
+  for (i = 0; i < ninstances; i++) {
+    printf("%s (at most %d queued)\n",
+           instances[i].port_name, outq_peak(instances[i].queue));
+    for (lane = 0; lane < OUTQ_LANES; lane++) {
+      outq_counts counts;
+      outq_stats(instances[i].queue, lane, &counts);
+      printf("  %-20s %10llu %9llu %10llu %9llu\n",
+             names[lane],
+             (unsigned long long)counts.queued,
+             (unsigned long long)counts.sent,
+             (unsigned long long)counts.superseded,
+             (unsigned long long)counts.dropped);
     }
-    else if (2 == line_number) {
-      char buf[255];
-      /*
-       * TODO: Make this a bit cleaner since there is a potential buffer
-       *       overrun possibility here.
-       */
-      /*
-       * Get the name of the instance from the configuration file.
-       */
-      fgets(buf, 255, fd);
-      /*
-       * Trim it and make sure that we have a null-terminated string.
-       */
-      buf[strlen(buf)-1] = 0;
+  }
+  fflush(stdout);
+}
 
-      debug("Read port name '%s'", buf);
 
-      /*
-       * If the -n flag was not provided to the program, lets set the
-       * port name to the line that was just found. Otherwise just ignore
-       *i it.
-       */
-      if (strlen(port_name) > 1) {
-        strncpy(port_name, buf, 255);
-      }
+/*
+ * What is needed to write the queued events of an instance.
+ */
+typedef struct {
+  snd_seq_t *seq_handle;
+  instance *inst;
+} queue_context;
 
-      if (0 != errno) {
-        error("Could not get MIDI port name from configuration file '%s'.",
-              filename);
-      }
-      continue;
+
+/*
+ * Write one queued event to the non-blocking sequencer, refusing when the
+ * output is full. An event the sequencer fails to take for any other
+ * reason is counted as lost.
+ */
+static int queue_write(snd_seq_event_t *ev, void *data, void *arg) {
+  queue_context *context = (queue_context *)arg;
+  int result = snd_seq_event_output_direct(context->seq_handle, ev);
+
+  if (-EAGAIN == result) {
+    return -1;
+  }
+  if (0 > result) {
+    context->inst->lost++;
+    return 0;
+  }
+  latency_record((histogram *)data, latency_ingress(ev));
+
+  return 0;
+}
+
+
+/*
+ * Write the queued events of all instances, urgent lane of every instance
+ * first, until everything is written or the output is full. Returns the
+ * number of events still queued.
+ */
+static int queue_flush(snd_seq_t *seq_handle,
+                       instance *instances,
+                       int ninstances) {
+  int full = 0;
+  int pending = 0;
+  int lane, i;
+
+  for (lane = 0; (lane < OUTQ_LANES) && (0 == full); lane++) {
+    for (i = 0; (i < ninstances) && (0 == full); i++) {
+      queue_context context = { seq_handle, &instances[i] };
+      full = (0 > outq_flush(instances[i].queue, lane, queue_write,
+                             &context));
     }
-    else {
-      int use_channel = 0;
-      translation_type type = TT_NONE;
-      /*
-       * Read each line of the configuration file and insert translations into
-       * the table.
-       */
-      if (4 != fscanf(fd, "%3d%1c%3d,%3d\n", &from, &c, &to, &channel)) {
-	debug("Falling back to only %d:1 channel", 1);
-        fscanf(fd, "%3d%1c%3d\n", &from, &c, &to);
-      }
-      else {
-        use_channel = 1;
-	debug("Reading %d:%d,%d", from, to, channel);
-        if ((16 < channel) || (0 > channel)) {
-          error("Channel number must be between 1 and 16, not %d", channel);
-        }
-      }
+  }
 
-      if (use_channel == 0) {
-        debug("Reading line %d '%d%c%d'", line_number, from, c, to);
-      }
-      else {
-        debug("Reading line %d '%d%c%d,%d'", line_number, from, c, to, channel);
-      }
+  for (i = 0; i < ninstances; i++) {
+    pending += outq_pending(instances[i].queue);
+  }
 
-      if (0 != errno) {
-        error("Error reading file '%s'.", filename);
-      }
+  return pending;
+}
 
-      /*
-       * Valid separators are '>' for CC and ':' for notes.
-       */
-      switch (c) {
-        case '>': {
-          type = TT_CC_TO_CC;
-          debug("Identified line as TT_CC_TO_CC (%c)", c);
-          capabilities = capabilities | (CB_ALSA_MIDI_IN | CB_ALSA_MIDI_OUT);
-          break;
-        }
-        case ':': {
-          type = TT_NOTE_TO_NOTE;
-          debug("Identified line as TT_NOTE_TO_NOTE (%c)", c);
-          capabilities = capabilities | (CB_ALSA_MIDI_IN | CB_ALSA_MIDI_OUT);
-          break;
-        }
-        case '!': {
-          type = TT_NOTE_TO_CC;
-          debug("Identified line as TT_NOTE_TO_CC (%c)", c);
-          capabilities = capabilities | (CB_ALSA_MIDI_IN | CB_ALSA_MIDI_OUT);
-          break;
-        }
-        case '?': {
-          type = TT_CC_TO_NOTE;
-          debug("Identified line as TT_CC_TO_NOTE (%c)", c);
-          capabilities = capabilities | (CB_ALSA_MIDI_IN | CB_ALSA_MIDI_OUT);
-          break;
-        }
-#ifdef USE_JACK
-        case 'J': {
-          debug("Identified line as TT_NOTE_TO_JACK (%c)", c);
-          if (1 == use_jack) {
-            error("Jack features are not enabled. Use -j, --jack to enable them\n");
-            exit(EXIT_FAILURE);
-          }
-          type = TT_NOTE_TO_JACK;
-          capabilities = capabilities | (CB_ALSA_MIDI_IN | CB_JACK_TRANSPORT_OUT);
-          break;
-        }
-#endif
-        case 'M': {
-          debug("Identified line as TT_NOTE_TO_MMC (%c)", c);
-          type = TT_NOTE_TO_MMC;
-          capabilities = capabilities | (CB_ALSA_MIDI_IN | CB_ALSA_MIDI_OUT);
-          break;
-        }
-        default: {
-          error("Separator '%c' is not valid in file '%s'.", c, filename);
-          break;
-        }
-      }
 
-      /*
-       * Perform some sanity checking on the from-value (since it can only be
-       * between 0 and 255 (or actually 0 and 127 in the MIDI world)
-       */
-      if ((0 > from) || (255 < from)) {
-        error("Line %d of '%s' has an invalid from value (must be 0-255).",
-              line_number, filename);
+/*
+ * Send a translated MIDI event from an instance to the sequencer, queued,
+ * directly or batched. The queue is written from the main loop, and an
+ * event it can not take is dropped, never waited for.
+ */
+static void midi2midi_output(snd_seq_t *seq_handle,
+                             output_batch *batch,
+                             instance *inst,
+                             snd_seq_event_t *ev,
+                             histogram *latency) {
+  if (NULL != inst->queue) {
+    outq_push(inst->queue, ev, latency);
+  }
+  else if (0 == batch->size) {
+    if (0 > snd_seq_event_output_direct(seq_handle, ev)) {
+      inst->lost++;
+      return;
+    }
+    latency_record(latency, latency_ingress(ev));
+  }
+  else if (0 > batch_output(seq_handle, batch, ev, latency)) {
+    inst->lost++;
+  }
+}
 
-      }
+/*
+ * Filter and translate a single MIDI event in place with the rules of an
+ * instance. Returns 1 if the (translated) event should be sent to the MIDI
+ * output port and 0 if it was consumed or filtered. Jack transport commands
+ * are handed to the transport thread here. The type of translation that was
+ * applied is stored in applied.
+ */
 #ifdef USE_JACK
-      if (TT_NOTE_TO_JACK != type) {
-        /*
-         * Perform some sanity checking on the to-value (since it can only be
-         * between 0 and 255 (or actually 0 and 127 in the MIDI world)
-         */
-        if ((0 > to) || (255 < to)) {
-          error("Line %d of '%s' has an invalid to value (must be 0-255).",
-                line_number, filename);
-        }
-      }
-      else {
-        /*
-         * Hard wire translate all the possible jack translation values
-         * and make them as similar as possible to MIDI Machine Control.
-         */
-        if (1 == to) {
-          to = JT_STOP;
-        }
-        else if (2 == to) {
-          to = JT_PLAY;
-        }
-        else if (4 == to) {
-          to = JT_FWD;
-        }
-        else if (5 == to) {
-          to = JT_REV;
-        }
-        else if (47 == to) {
-          to = JT_WHEEL;
-        }
-        else {
-          error("%d is not a valid jack transport value (1, 2, 4, 5, 47)",
-                to);
-        }
-      }
+static int midi2midi_translate(snd_seq_event_t *ev,
+                               translation_type *applied,
+                               jack_transport *transport,
+                               const m2m_rules *rules,
+                               m2m_state *state,
+                               int use_jack) {
+#else
+static int midi2midi_translate(snd_seq_event_t *ev,
+                               translation_type *applied,
+                               const m2m_rules *rules,
+                               m2m_state *state) {
 #endif
+  snd_seq_event_t out[M2M_MAX_EVENTS];
+
+  if (0 == m2m_translate(rules, state, ev, out, M2M_MAX_EVENTS, applied)) {
+    trace("Filtering event %d", ev->type);
+    return 0;
+  }
 
+  if (TT_NONE != *applied) {
+    trace("Translating event %d with %s to event %d",
+          ev->type, translation_type_name(*applied), out[0].type);
+  }
+
+  if (M2M_EVENT_JACK_TRANSPORT == out[0].type) {
+#ifdef USE_JACK
+    if ((1 == use_jack) && (NULL != transport)) {
       /*
-       * Insert the note transformation in the translation table.
+       * Queue a jack transport command for the transport thread.
        */
-      switch (type) {
-        case TT_NOTE_TO_NOTE:
-        case TT_NOTE_TO_CC:
-#ifdef USE_JACK
-        case TT_NOTE_TO_JACK:
+      jack_transport_send(transport,
+                          out[0].data.control.param,
+                          out[0].data.control.value);
+    }
 #endif
-        case TT_NOTE_TO_MMC: {
-          /*
-           * Make sure that there are no duplicates in the note translation
-           * table.
-           */
-          if (TT_NONE != note_table[from].type) {
-            error("Note value %d is already translated on line %d with value "
-                  "%d on line %d of file '%s'",
-                  from, cc_table[from].line, cc_table[from].value, line_number,
-                  filename);
-          }
-          note_table[from].type = type;
-          note_table[from].value = to;
-	  if (use_channel) {
- 	    note_table[from].channel = channel;
-	  }
-          break;
-        }
-        case TT_CC_TO_NOTE:
-        case TT_CC_TO_CC: {
-          /*
-           * Make sure that there are no duplicates in the MIDI Contentious
-           * Control translation table.
-           */
-          if (TT_NONE != cc_table[from].type) {
-            error("CC value %d is already translated on line %d with value %d"
-                  "on line %d of file '%s'",
-                  from, cc_table[from].line, cc_table[from].value, line_number,
-                  filename);
-          }
-          cc_table[from].type = type;
-          cc_table[from].value = to;
-          if (use_channel) {
-            cc_table[from].channel = channel;
-          }
+    return 0;
+  }
 
-          break;
-        }
-        default: {
-          error("Type %d is not implemented yet", type);
+  *ev = out[0];
 
-          break;
-        }
-      }
-      continue;
+  return 1;
+}
+
+/*
+ * Run the translation engine on synthetic events for every note and MIDI
+ * Continuous Controller on every channel, so that every page the steady-state
+ * event path touches is faulted in. Returns the number of page faults this
+ * caused.
+ */
+static long midi2midi_warmup(const m2m_rules *rules,
+                             const m2m_options *options) {
+  snd_seq_event_t ev, out[M2M_MAX_EVENTS];
+  translation_type applied;
+  m2m_state state;
+  long faults = realtime_page_faults();
+  int i;
+
+  m2m_state_init(&state, options, NULL);
+
+  for (i = 0; i < 16 * 128; i++) {
+    memset(&ev, 0, sizeof(ev));
+    ev.type = SND_SEQ_EVENT_NOTEON;
+    ev.data.note.channel = i / 128;
+    ev.data.note.note = i % 128;
+    ev.data.note.velocity = 64;
+    m2m_translate(rules, &state, &ev, out, M2M_MAX_EVENTS, &applied);
+
+    memset(&ev, 0, sizeof(ev));
+    ev.type = SND_SEQ_EVENT_CONTROLLER;
+    ev.data.control.channel = i / 128;
+    ev.data.control.param = i % 128;
+    ev.data.control.value = 64;
+    m2m_translate(rules, &state, &ev, out, M2M_MAX_EVENTS, &applied);
+  }
+
+  return realtime_page_faults() - faults;
+}
+
+
+/*
+ * Push every event of a recorded session through the filter and
+ * translation, without any MIDI device, and report the throughput. Jack
+ * transport translations are counted but never sent.
+ */
+static void midi2midi_replay(const char *filename, instance *inst) {
+  replay *r = replay_new(filename);
+  uint64_t counts[TT_COUNT] = { 0 };
+  uint64_t sent = 0;
+  uint64_t events;
+  uint64_t start, elapsed, cycles;
+  int passes = 0;
+  int type;
+
+  if (0 == r->nevents) {
+    error("No MIDI events found in '%s'.", filename);
+  }
+
+  start = timestamp_now();
+  cycles = timestamp_cycles();
+  do {
+    size_t i;
+    for (i = 0; i < r->nevents; i++) {
+      snd_seq_event_t ev = r->events[i];
+      translation_type applied;
+#ifdef USE_JACK
+      sent += midi2midi_translate(&ev, &applied, NULL,
+                                  instance_rules(inst), &inst->state, 0);
+#else
+      sent += midi2midi_translate(&ev, &applied,
+                                  instance_rules(inst), &inst->state);
+#endif
+      counts[applied]++;
     }
+    passes++;
+    elapsed = timestamp_now() - start;
+  } while (elapsed < REPLAY_MIN_TIME);
+  cycles = timestamp_cycles() - cycles;
+
+  events = (uint64_t)passes * r->nevents;
+
+  printf("Replayed %lu events from '%s' %d times\n",
+         (unsigned long)r->nevents, filename, passes);
+  printf("  %.0f events/s, %.1f ns/event, %.1f%% sent\n",
+         events * 1e9 / elapsed,
+         (double)elapsed / events,
+         sent * 100.0 / events);
+  if (0 != cycles) {
+    printf("  %.1f cycles/event (time-stamp counter)\n",
+           (double)cycles / events);
   }
+  for (type = 0; type < TT_COUNT; type++) {
+    if (0 != counts[type]) {
+      printf("  %-20s %10lu %5.1f%%\n",
+             translation_type_name(type),
+             (unsigned long)(counts[type] / passes),
+             counts[type] * 100.0 / events);
+    }
+  }
+
+  replay_delete(r);
+}
+
+
+/*
+ * Thin out continuous data on the controller path, events that were not
+ * translated or translated from controller to controller. Returns 1 if the
+ * event should still be sent.
+ */
+static int midi2midi_thin(instance *inst,
+                          const snd_seq_event_t *ev,
+                          translation_type applied,
+                          int send_midi) {
+  if ((0 == send_midi) || (NULL == inst->thin) ||
+      ((TT_NONE != applied) && (TT_CC_TO_CC != applied))) {
+    return send_midi;
+  }
+
+  return thin_event(inst->thin, ev, timestamp_now());
+}
+
+
+/*
+ * Everything needed to write held continuous data when it is due.
+ */
+typedef struct {
+  snd_seq_t *seq_handle;
+  output_batch *batch;
+  instance *inst;
+  snd_rawmidi_t *rawmidi_out;
+  midi_stream_encoder *encoder;
+} thin_context;
+
+
+/*
+ * Output callback for held continuous data.
+ */
+static void midi2midi_thin_output(snd_seq_event_t *ev, void *arg) {
+  thin_context *context = (thin_context *)arg;
+
+  if (NULL != context->rawmidi_out) {
+    unsigned char buf[3];
+    size_t len = midi_stream_encode(context->encoder, ev, buf, sizeof(buf));
+    snd_rawmidi_write(context->rawmidi_out, buf, len);
+    return;
+  }
+
+  snd_seq_ev_set_subs(ev);
+  snd_seq_ev_set_direct(ev);
+  snd_seq_ev_set_source(ev, context->inst->out_port);
+  midi2midi_output(context->seq_handle, context->batch, context->inst, ev,
+                   NULL);
+}
+
+
+/*
+ * Write the held continuous data of all instances that is due, and get the
+ * time the next is due, or 0.
+ */
+static uint64_t midi2midi_thin_flush(thin_context *context,
+                                     instance *instances,
+                                     int ninstances) {
+  uint64_t now = timestamp_now();
+  uint64_t next = 0;
+  int i;
 
-  debug("Reached end of file '%s'", filename);
+  for (i = 0; i < ninstances; i++) {
+    uint64_t due = thin_due(instances[i].thin);
+    if ((0 != due) && (due <= now)) {
+      context->inst = &instances[i];
+      thin_flush(instances[i].thin, now, midi2midi_thin_output, context);
+      due = thin_due(instances[i].thin);
+    }
+    if ((0 != due) && ((0 == next) || (due < next))) {
+      next = due;
+    }
+  }
 
-  fclose(fd);
+  if ((NULL != context->seq_handle) && (0 != context->batch->size)) {
+    batch_flush(context->seq_handle, context->batch);
+  }
 
-  return capabilities;
+  return next;
 }
 
-#define FILTERMODE(NAME, ALSANAME)                                      \
-  loc_filter |= ((0 != (filter & MT_ ## NAME)) && (SND_SEQ_EVENT_ ## ALSANAME == ev->type))
 
 /*
  * Main event loop.
  */
 #ifdef USE_JACK
 static void midi2midi(snd_seq_t *seq_handle,
-                      jack_client_t *jack_client,
-                      struct pollfd *pfd,
-                      int npfd,
-                      int in_port,
-                      int out_port,
-                      translation note_table[256],
-                      translation cc_table[256],
-                      int program_change_prevention,
-                      message_type filter,
+                      jack_transport *transport,
+                      instance *port_map[256],
+                      output_batch *batch,
+                      pipeline *pipe,
                       int use_jack) {
 #else
 static void midi2midi(snd_seq_t *seq_handle,
-                      struct pollfd *pfd,
-                      int npfd,
-                      int in_port,
-                      int out_port,
-                      translation note_table[256],
-                      translation cc_table[256],
-                      int program_change_prevention,
-                      message_type filter) {
+                      instance *port_map[256],
+                      output_batch *batch,
+                      pipeline *pipe) {
 #endif
   /*
    * Note parameters
@@ -537,264 +882,418 @@ static void midi2midi(snd_seq_t *seq_handle,
   }
 
   /*
-   * Poll the ALSA midi interface for events.
+   * Loop over all events. (While at the end) This is only called when the
+   * main loop found the ALSA midi interface readable, so there is at least
+   * one event to get.
    */
-  if (poll(pfd, npfd, 100) > 0) {
+  do {
+    int send_midi = 0;
+    translation_type applied = TT_NONE;
+    instance *inst;
+
     /*
-     * Loop over all events. (While at the end)
+     * Get the event information. The input port it arrived on tells which
+     * instance it belongs to.
      */
-    do {
-      int send_midi = 1;
-      int loc_filter = 0;
-
-      /*
-       * Get the event information.
-       */
-      snd_seq_event_input(seq_handle, &ev);
-      snd_seq_ev_set_subs(ev);
-      snd_seq_ev_set_direct(ev);
+    int result = snd_seq_event_input(seq_handle, &ev);
 
-      if (filter != MT_NONE) {
-        FILTERMODE(NOTE_ON, NOTEON);
-        FILTERMODE(NOTE_ON, NOTE);
-
-        FILTERMODE(NOTE_OFF, NOTEOFF);
-        FILTERMODE(NOTE_OFF, NOTE);
-
-        FILTERMODE(POLYPHONIC_KEY_PRESSURE, KEYPRESS);
+    /*
+     * An overrun means the sequencer has thrown away everything that was
+     * waiting, what arrives next is read as usual.
+     */
+    if (-ENOSPC == result) {
+      input_overruns++;
+      debug("Input overrun %llu, events were lost",
+            (unsigned long long)input_overruns);
+      continue;
+    }
+    if (0 > result) {
+      break;
+    }
+    if (1 == measure_latency) {
+      latency_stamp(ev, timestamp_now());
+    }
 
-        FILTERMODE(CONTROL_CHANGE, CONTROLLER);
+    /*
+     * With worker threads the event is copied to its worker as it is and
+     * everything else happens there.
+     */
+    if (NULL != pipe) {
+      pipeline_push(pipe, ev);
+      snd_seq_free_event(ev);
+      continue;
+    }
 
-        FILTERMODE(PROGRAM_CHANGE, PGMCHANGE);
+    inst = port_map[ev->dest.port];
+    snd_seq_ev_set_subs(ev);
+    snd_seq_ev_set_direct(ev);
 
-        FILTERMODE(CHANNEL_PRESSURE, CHANPRESS);
+    if (NULL != inst) {
+#ifdef USE_JACK
+      send_midi = midi2midi_translate(ev,
+                                      &applied,
+                                      transport,
+                                      instance_rules(inst),
+                                      &inst->state,
+                                      use_jack);
+#else
+      send_midi = midi2midi_translate(ev,
+                                      &applied,
+                                      instance_rules(inst),
+                                      &inst->state);
+#endif
+      send_midi = midi2midi_thin(inst, ev, applied, send_midi);
+    }
 
-        FILTERMODE(PITCH_BEND_CHANGE, PITCHBEND);
+    /*
+     * If a new MIDI event was prepared it must be forwarded.
+     */
+    if ((1 == send_midi) && (0 <= inst->out_port)) {
+      /*
+       * Output the translated note to the MIDI output port.
+       */
+      snd_seq_ev_set_source(ev, inst->out_port);
+      midi2midi_output(seq_handle, batch, inst, ev,
+                       latency_histogram(inst, applied));
+    }
 
-        FILTERMODE(SYSEX, SYSEX);
+    /*
+     * Get back the system memory allocated for the incoming MIDI event.
+     */
+    snd_seq_free_event(ev);
 
-        FILTERMODE(MIDI_TIME_CODE_QUARTER_FRAME, QFRAME);
+  } while (snd_seq_event_input_pending(seq_handle, 0) > 0);
 
-        FILTERMODE(SONG_POSITION_POINTER, SONGPOS);
+  /*
+   * Everything read in this wake-up is translated, send what is left.
+   */
+  if (NULL != pipe) {
+    pipeline_kick(pipe);
+  }
+  else {
+    batch_flush(seq_handle, batch);
+  }
+}
 
-        FILTERMODE(SONG_SELECT, SONGSEL);
+/*
+ * Record the latency of every event written since the last write, counted
+ * per translation type.
+ */
+static void midi2midi_rawmidi_record(histogram *latency,
+                                     int pending[TT_COUNT],
+                                     uint64_t ingress) {
+  int type;
+
+  for (type = 0; type < TT_COUNT; type++) {
+    for (; 0 < pending[type]; pending[type]--) {
+      latency_record(&latency[type], ingress);
+    }
+  }
+}
 
-        FILTERMODE(TUNE_REQUEST, TUNE_REQUEST);
 
-        FILTERMODE(TIMING_CLOCK, CLOCK);
-        FILTERMODE(TIMING_CLOCK, TICK);
+/*
+ * Event loop for the rawmidi backend. Everything the input device has is
+ * read, parsed and translated, and the result is written with one write.
+ * When latency is measured, every byte of a read shares the time the read
+ * returned.
+ */
+#ifdef USE_JACK
+static void midi2midi_rawmidi(snd_rawmidi_t *rawmidi_in,
+                              snd_rawmidi_t *rawmidi_out,
+                              midi_stream_parser *parser,
+                              midi_stream_encoder *encoder,
+                              jack_transport *transport,
+                              instance *inst,
+                              int use_jack) {
+#else
+static void midi2midi_rawmidi(snd_rawmidi_t *rawmidi_in,
+                              snd_rawmidi_t *rawmidi_out,
+                              midi_stream_parser *parser,
+                              midi_stream_encoder *encoder,
+                              instance *inst) {
+#endif
+  histogram *latency = inst->latency;
+  unsigned char in_buf[RAWMIDI_IN_BUFFER_SIZE];
+  unsigned char out_buf[RAWMIDI_OUT_BUFFER_SIZE];
+  int pending[TT_COUNT] = { 0 };
+  ssize_t len;
+
+  while ((len = snd_rawmidi_read(rawmidi_in, in_buf, sizeof(in_buf))) > 0) {
+    uint64_t ingress = (NULL != latency) ? timestamp_now() : 0;
+    size_t out_len = 0;
+    ssize_t i;
+
+    for (i = 0; i < len; i++) {
+      snd_seq_event_t ev;
+      translation_type applied;
+      int send_midi;
+
+      if (0 == midi_stream_parse(parser, in_buf[i], &ev)) {
+        continue;
+      }
 
-        FILTERMODE(MMC, START);
-        FILTERMODE(MMC, STOP);
-        FILTERMODE(MMC, CONTINUE);
+#ifdef USE_JACK
+      send_midi = midi2midi_translate(&ev,
+                                      &applied,
+                                      transport,
+                                      instance_rules(inst),
+                                      &inst->state,
+                                      use_jack);
+#else
+      send_midi = midi2midi_translate(&ev,
+                                      &applied,
+                                      instance_rules(inst),
+                                      &inst->state);
+#endif
+      if (0 == midi2midi_thin(inst, &ev, applied, send_midi)) {
+        continue;
       }
 
       /*
-       * Translate either a note or a CC command.
+       * Make sure that the largest possible message still fits.
        */
-      if (0 != loc_filter) {
-        debug("Filtering event %d\n", ev->type);
-        send_midi = 0;
+      if (sizeof(out_buf) - out_len < MIDI_STREAM_SYSEX_SIZE) {
+        snd_rawmidi_write(rawmidi_out, out_buf, out_len);
+        out_len = 0;
+        if (NULL != latency) {
+          midi2midi_rawmidi_record(latency, pending, ingress);
+        }
       }
-      else if (((SND_SEQ_EVENT_NOTEON == ev->type) ||
-                (SND_SEQ_EVENT_NOTEOFF == ev->type)) &&
-               (TT_NONE != note_table[ev->data.note.note].type)) {
-
-        switch (note_table[ev->data.note.note].type) {
-
-          case TT_NOTE_TO_NOTE: {
-            /*
-             * Prepare to just forward a translated note.
-             */
-            if (note_table[ev->data.note.note].channel > 0 && 
-                note_table[ev->data.note.note].channel < 17) {
-              debug("Translating note %d to note %d on channel %d, event type %d",
-                    ev->data.note.note,
-                    note_table[ev->data.note.note].value,
-                    note_table[ev->data.note.note].channel,
-                    ev->type);
-              ev->data.note.channel = note_table[ev->data.note.note].channel - 1;
-            }
-            else {
-              debug("Translating note %d to note %d, event type %d",
-                    ev->data.note.note,
-                    note_table[ev->data.note.note].value,
-                    ev->type);
-            }
-            ev->data.note.note = note_table[ev->data.note.note].value;
+      out_len += midi_stream_encode(encoder, &ev, &out_buf[out_len],
+                                    sizeof(out_buf) - out_len);
+      pending[applied]++;
+    }
 
-            break;
-          }
-          case TT_NOTE_TO_CC: {
-            /*
-             * Prepare to map note to a parameter id and velocity to the value.
-             */
-            if (note_table[ev->data.note.note].channel > 0 &&
-                note_table[ev->data.note.note].channel < 17) {
-              debug("Translating note %d to cc %d on channel %d",
-                    ev->data.note.note,
-                    note_table[ev->data.note.note].value,
-                    note_table[ev->data.note.note].channel);
-              ev->data.note.channel = note_table[ev->data.note.note].channel - 1;
-            }
-            else {
-              debug("Translating note %d to cc %d",
-                    ev->data.note.note,
-                    note_table[ev->data.note.note].value);
-            }
-            ev->data.note.note = note_table[ev->data.note.note].value;
-            ev->type = SND_SEQ_EVENT_CONTROLLER;
-            ev->data.control.param = note_table[ev->data.note.note].value;
-            ev->data.control.value = ev->data.note.velocity;
+    if (0 != out_len) {
+      snd_rawmidi_write(rawmidi_out, out_buf, out_len);
+      if (NULL != latency) {
+        midi2midi_rawmidi_record(latency, pending, ingress);
+      }
+    }
+  }
+}
 
-            break;
-          }
 #ifdef USE_JACK
-          case TT_NOTE_TO_JACK: {
-            if (0 == use_jack) {
-              send_midi = 0;
-              break;
-            }
-            /*
-             * Send a jack transport command.
-             */
-            jack_transport_send(jack_client,
-                                note_table[ev->data.note.note].value,
-                                ev->data.note.velocity);
+/*
+ * Everything the translation needs when it runs in the Jack process
+ * callback.
+ */
+typedef struct {
+  jack_transport *transport;
+  instance *inst;
+} jack_midi_context;
 
-            send_midi = 0;
 
-            break;
-          }
+/*
+ * Translation callback for the Jack MIDI ports.
+ */
+static int midi2midi_jack_translate(snd_seq_event_t *ev, void *arg) {
+  jack_midi_context *context = (jack_midi_context *)arg;
+
+  translation_type applied;
+
+  return midi2midi_translate(ev,
+                             &applied,
+                             context->transport,
+                             instance_rules(context->inst),
+                             &context->inst->state,
+                             1);
+}
 #endif
-          default: {
-            /*
-             * Some note-translation that is not supported should
-             * end-up here.
-             */
-            error("Note translation %d is not implemented yet.",
-                  note_table[ev->data.note.note].type);
-
-            break;
-          }
-        }
 
-      }
-      else if ((SND_SEQ_EVENT_CONTROLLER == ev->type) &&
-               (TT_NONE != cc_table[ev->data.control.param].type)) {
-        /*
-         * When midi2midi receives a MIDI Continuous Controller message and
-         * the from-value (index) is set in the translation table for MIDI
-         */
-        switch (cc_table[ev->data.control.param].type) {
-
-          case TT_CC_TO_CC: {
-            /*
-             * Prepare to translate a MIDI Continuous Controller into another
-             * MIDI Continuous Controller according to the configuration file.
-             */
-            if (cc_table[ev->data.control.param].channel > 0 && 
-                cc_table[ev->data.control.param].channel < 17) {
-              debug("Translating MIDI CC %d to MIDI CC %d on channel %d, event type %d",
-                    ev->data.control.param,
-                    cc_table[ev->data.control.param].value,
-                    cc_table[ev->data.control.param].channel,
-                    ev->type);
-              ev->data.control.channel = cc_table[ev->data.control.param].channel;
-            }
-            else {
-              debug("Translating MIDI CC %d to MIDI CC %d",
-                    ev->data.control.param,
-                    cc_table[ev->data.control.param].value);
-            }
-            ev->data.control.param = cc_table[ev->data.control.param].value;
+/*
+ * Everything the worker and output threads need when translating with a
+ * pipeline.
+ */
+typedef struct {
+  snd_seq_t *seq_handle;
+#ifdef USE_JACK
+  jack_transport *transport;
+  int use_jack;
+#endif
+  instance **port_map;
+  instance **out_map;
+  output_batch *batch;
+} pipeline_context;
 
-            break;
-          }
-          case TT_CC_TO_NOTE: {
-            /*
-             * Prepare to translate a MIDI Continuous Controller into a note
-             * and value to the velocity.
-             */
-            if (cc_table[ev->data.control.param].channel > 0 && 
-                cc_table[ev->data.control.param].channel < 17) {
-              debug("Translating MIDI CC %d to note %d on channel %d",
-                    ev->data.control.param,
-                    cc_table[ev->data.control.param].value,
-                    cc_table[ev->data.control.param].channel);
-              ev->data.control.channel = cc_table[ev->data.control.param].channel;
-            }
-            else {
-              debug("Translating MIDI CC %d to note %d",
-                    ev->data.control.param,
-                    cc_table[ev->data.control.param].value);
-            }
-            ev->data.control.param = cc_table[ev->data.control.param].value;
-            ev->type = ev->data.control.value ? SND_SEQ_EVENT_NOTEON : SND_SEQ_EVENT_NOTEOFF;
-            ev->data.note.note = cc_table[ev->data.control.param].value;
-            ev->data.note.velocity = ev->data.control.value;
 
-            break;
-          }
-          default: {
-            error("MIDI Continuous Controller translation %d is not "
-                  "implemented yet.",
-                  cc_table[ev->data.control.param].type);
+/*
+ * Translation callback for the pipeline worker threads. The applied
+ * translation type is handed to the output thread in the event tag, which
+ * is cleared again before the event is written.
+ */
+static int midi2midi_pipeline_translate(snd_seq_event_t *ev, void *arg) {
+  pipeline_context *context = (pipeline_context *)arg;
+  instance *inst = context->port_map[ev->dest.port];
+  translation_type applied;
+  int send_midi;
+
+  if ((NULL == inst) || (0 > inst->out_port)) {
+    return 0;
+  }
 
-            break;
-          }
-        }
-      }
-      else if ((SND_SEQ_EVENT_PGMCHANGE == ev->type) &&
-               (1 == program_change_prevention)) {
-        /*
-         * Only translate a MIDI Continuous Controller into another MIDI
-         * Continuous Controller value if the parameter value actually
-         * changed.
-         */
-        if (cc_table[ev->data.control.param].last_value !=
-            ev->data.control.value) {
-          /*
-           * The new value seem to be different than the last translated
-           * one so lets produce the translation.
-           */
+  snd_seq_ev_set_subs(ev);
+  snd_seq_ev_set_direct(ev);
+  snd_seq_ev_set_source(ev, inst->out_port);
 
-          debug("Program changed to %d value changed",
-                ev->data.control.param,
-                cc_table[ev->data.control.param].value);
+#ifdef USE_JACK
+  send_midi = midi2midi_translate(ev,
+                                  &applied,
+                                  context->transport,
+                                  instance_rules(inst),
+                                  &inst->state,
+                                  context->use_jack);
+#else
+  send_midi = midi2midi_translate(ev,
+                                  &applied,
+                                  instance_rules(inst),
+                                  &inst->state);
+#endif
+  ev->tag = (unsigned char)applied;
 
-          ev->data.control.param = cc_table[ev->data.control.param].value;
+  return send_midi;
+}
 
-          cc_table[ev->data.control.param].last_value =
-          ev->data.control.value;
 
-        }
-        else {
-          debug("Preventing program change to %d since value did not change",
-                ev->data.control.param);
-          send_midi = 0;
-        }
+/*
+ * Output callback for the pipeline output thread.
+ */
+static void midi2midi_pipeline_output(snd_seq_event_t *ev, void *arg) {
+  pipeline_context *context = (pipeline_context *)arg;
+  instance *inst = context->out_map[ev->source.port];
+  histogram *latency = latency_histogram(inst, ev->tag);
+  int result;
+
+  ev->tag = 0;
+  if (0 == context->batch->size) {
+    result = snd_seq_event_output_direct(context->seq_handle, ev);
+    if (0 <= result) {
+      latency_record(latency, latency_ingress(ev));
+    }
+  }
+  else {
+    result = batch_output(context->seq_handle, context->batch, ev, latency);
+  }
 
-      }
+  /*
+   * Counted from this thread while the main thread reports.
+   */
+  if ((0 > result) && (NULL != inst)) {
+    __atomic_fetch_add(&inst->lost, 1, __ATOMIC_RELAXED);
+  }
+}
 
-      /*
-       * If a new MIDI event was prepared it must be forwarded.
-       */
-      if (1 == send_midi) {
-        /*
-         * Output the translated note to the MIDI output port.
-         */
-        snd_seq_ev_set_source(ev, out_port);
-        snd_seq_event_output_direct(seq_handle, ev);
+
+/*
+ * Flush callback for the pipeline output thread.
+ */
+static void midi2midi_pipeline_flush(void *arg) {
+  pipeline_context *context = (pipeline_context *)arg;
+
+  batch_flush(context->seq_handle, context->batch);
+}
+
+/*
+ * Reload callback, run on the reload thread. All configuration files are
+ * read into new rule sets first, and only if all of them are valid are the
+ * rules of the instances replaced. The event path keeps translating with
+ * the old rules meanwhile, and the old rules are freed once no thread can
+ * be using them any more. Port names and new capabilities need a restart.
+ */
+static void midi2midi_reload(void *arg) {
+  reload_context *context = (reload_context *)arg;
+  m2m_rules *rules[MAX_INSTANCES];
+  char message[CONFIG_MESSAGE_SIZE];
+  int i;
+
+  for (i = 0; i < context->ninstances; i++) {
+    instance *inst = &context->instances[i];
+    capability capabilities = CB_NONE;
+    char port_name[255];
+
+    strcpy(port_name, inst->port_name);
+#ifdef USE_JACK
+    rules[i] = config_rules(inst->config_file, port_name, &capabilities,
+                            message, context->use_jack);
+#else
+    rules[i] = config_rules(inst->config_file, port_name, &capabilities,
+                            message);
+#endif
+    if (NULL != rules[i]) {
+      if (0 != strcmp(port_name, inst->port_name)) {
+        warning("The port name of '%s' changed, restart to rename it.",
+                inst->config_file);
       }
+      if (capabilities != (capabilities & context->capabilities)) {
+        warning("'%s' needs other ports than it was started with, restart "
+                "to use all of it.", inst->config_file);
+      }
+      continue;
+    }
 
-      /*
-       * Get back the system memory allocated for the incoming MIDI event.
-       */
-      snd_seq_free_event(ev);
+    warning("Keeping the old configuration: %s", message);
+    while (0 < i) {
+      image_delete(rules[--i]);
+    }
+    return;
+  }
 
-    } while (snd_seq_event_input_pending(seq_handle, 0) > 0);
+  for (i = 0; i < context->ninstances; i++) {
+    rules[i] = __atomic_exchange_n(&context->instances[i].rules, rules[i],
+                                   __ATOMIC_ACQ_REL);
   }
+
+  rcu_synchronize(context->rcu);
+
+  for (i = 0; i < context->ninstances; i++) {
+    image_delete(rules[i]);
+  }
+
+  debug("Reloaded %d configuration files", context->ninstances);
+}
+
+/*
+ * Check that configuration files are valid, without loading or compiling
+ * them. Every problem is reported, returns the number of invalid files.
+ */
+#ifdef USE_JACK
+static int midi2midi_check(char *config_files[], int nconfig_files,
+                           int use_jack) {
+#else
+static int midi2midi_check(char *config_files[], int nconfig_files) {
+#endif
+  char port_name[255];
+  char message[CONFIG_MESSAGE_SIZE];
+  int failures = 0;
+  int i;
+
+  for (i = 0; i < nconfig_files; i++) {
+    capability capabilities = CB_NONE;
+    m2m_rules *rules = image_new();
+    int retval;
+
+    if (NULL == rules) {
+      error("Could not allocate a rule set%c", '.');
+    }
+#ifdef USE_JACK
+    retval = config_load(config_files[i], rules, port_name, &capabilities,
+                         message, use_jack);
+#else
+    retval = config_load(config_files[i], rules, port_name, &capabilities,
+                         message);
+#endif
+    if (0 == retval) {
+      printf("%s: OK\n", config_files[i]);
+    }
+    else {
+      fprintf(stderr, "%s\n", message);
+      failures++;
+    }
+    image_delete(rules);
+  }
+
+  return failures;
 }
 
 #define MODE_CONV(NAME)                                  \
@@ -846,42 +1345,95 @@ int main(int argc, char *argv[]) {
 
   char *app_name = APPNAME;
   char port_name[255];
-  char *config_file = NULL;
-  int program_change_prevention = 0;
+  char *config_files[MAX_INSTANCES];
+  int nconfig_files = 0;
+  int client_name_given = 0;
+  int suppress = 0;
+  char *state_file = NULL;
+  m2m_cache *caches = NULL;
   message_type filter = MT_NONE;
+  m2m_options options;
+  output_batch batch = { 0 };
+  int realtime_priority = 0;
+  int realtime_cpu = -1;
+  int threads = 0;
+  char *replay_file = NULL;
+  int check = 0;
+  thin_policy thin_policies[THIN_TYPES] = { { 0, 0 } };
+  int thinning = 0;
+  thin_context thin_ctx;
+  int queue_size = 0;
+  int pool_size = 0;
+  int input_buffer_size = 0;
+  int output_buffer_size = 0;
+  outq_policy queue_policy = OUTQ_SUPERSEDE;
+  int output_waiting = 0;
+  pipeline_shard shard = SHARD_BY_PORT;
+  pipeline *pipe = NULL;
+  pipeline_context pipe_context;
+  char message[CONFIG_MESSAGE_SIZE];
+  reload_context rules_context;
+  reload *reloader = NULL;
+  rcu *rules_rcu;
+  int reader;
 
 #ifdef USE_JACK
   int use_jack = 0;
+  int use_jack_midi = 0;
+  int wheel_interval = 0;
+  int wheel_acceleration = 0;
+  jack_midi *jm = NULL;
+  jack_midi_context jack_context;
 #endif
 
   /*
    * This variable holds a bit pattern describing what resources need to be
    * allocated. (ALSA/Jack)
    */
-  capability capabilities = CB_NONE;
+  capability capabilities = CB_NONE;
+
+  /*
+   * Handles and IDs to ALSA stuff.
+   */
+  snd_seq_t *seq_handle = NULL;
+  int use_alsa_in, use_alsa_out;
+  int npfd = 0;
+  struct pollfd *pfd = NULL;
+
+  /*
+   * Handles for the rawmidi backend, used instead of the ALSA sequencer
+   * when devices are given with -i and -o.
+   */
+  char *rawmidi_in_device = NULL;
+  char *rawmidi_out_device = NULL;
+  snd_rawmidi_t *rawmidi_in = NULL;
+  snd_rawmidi_t *rawmidi_out = NULL;
+  midi_stream_parser parser;
+  midi_stream_encoder encoder;
 
   /*
-   * Handles and IDs to ALSA stuff.
+   * The main loop waits on the ALSA poll descriptors and the signal
+   * descriptor, without any time-out.
    */
-  snd_seq_t *seq_handle = NULL;
-  int in_port, out_port;
-  int *in_port_ptr, *out_port_ptr;
-  int npfd = 0;
-  struct pollfd *pfd;
+  event_loop *loop;
+  int quit_fd;
+  int i;
 
   /*
    * Handles for Jack client stuff.
    */
 #ifdef USE_JACK
-  jack_client_t *jack_client = NULL;
+  jack_transport *transport = NULL;
 #endif
   /*
-   * This is where the note translation-table is stored.
+   * This is where the translation instances, and with them the note
+   * translation-tables, are stored. The port map finds the instance an
+   * event belongs to from the ALSA input port it arrived on.
    */
-  translation note_table[255];
-  translation cc_table[255];
-
-  in_port_ptr = out_port_ptr = NULL;
+  instance *instances;
+  int ninstances;
+  static instance *port_map[256];
+  static instance *out_map[256];
 
   /*
    * Command line options variables.
@@ -892,9 +1444,26 @@ int main(int argc, char *argv[]) {
     {"config", required_argument, NULL,  'c'},
     {"client-name", required_argument, NULL, 'n'},
     {"program-repeat-prevent", no_argument, NULL, 'p'},
+    {"suppress", optional_argument, NULL, 's'},
+    {"state-file", required_argument, NULL, 'S'},
     {"filter-all-but", required_argument, NULL, 'f'},
+    {"batch", optional_argument, NULL, 'b'},
+    {"realtime", optional_argument, NULL, 'r'},
+    {"cpu", required_argument, NULL, 'a'},
+    {"rawmidi-in", required_argument, NULL, 'i'},
+    {"rawmidi-out", required_argument, NULL, 'o'},
+    {"threads", required_argument, NULL, 'T'},
+    {"latency", no_argument, NULL, 'l'},
+    {"replay", required_argument, NULL, 'R'},
+    {"check", no_argument, NULL, 'C'},
+    {"thin", required_argument, NULL, 't'},
+    {"queue", optional_argument, NULL, 'q'},
+    {"pool", required_argument, NULL, 'P'},
+    {"buffers", required_argument, NULL, 'B'},
 #ifdef USE_JACK
     {"jack", no_argument, NULL, 'j'},
+    {"jack-midi", no_argument, NULL, 'J'},
+    {"wheel", required_argument, NULL, 'w'},
 #endif
     {"debug", no_argument, NULL,  'd'},
     {0, 0, 0,  0 }
@@ -908,7 +1477,8 @@ int main(int argc, char *argv[]) {
   while(1) {
     int option_index = 0;
     int c;
-    c = getopt_long(argc, argv, "dn:c:hpv?f:j",
+    c = getopt_long(argc, argv,
+                    "dn:c:hpv?f:jJw:b::r::a:i:o:T:lR:Ct:q::s::S:P:B:",
                     long_options, &option_index);
     if (c == -1) {
       break;
@@ -927,11 +1497,15 @@ int main(int argc, char *argv[]) {
         break;
       }
       case 'c': {
-        config_file = optarg;
+        if (MAX_INSTANCES == nconfig_files) {
+          error("At most %d configuration files can be given.",
+                MAX_INSTANCES);
+        }
+        config_files[nconfig_files++] = optarg;
         break;
       }
       case 'p': {
-        program_change_prevention = 1;
+        suppress |= M2M_SUPPRESS_PROGRAM;
         /*
          * The repeated-program-change-prevention feature requires MIDI in and
          * out.
@@ -939,6 +1513,43 @@ int main(int argc, char *argv[]) {
         capabilities = CB_ALSA_MIDI_IN | CB_ALSA_MIDI_OUT;
         break;
       }
+      case 's': {
+        char *what;
+        suppress |= (NULL == optarg) ? M2M_SUPPRESS_ALL : 0;
+        for (what = (NULL == optarg) ? NULL : strtok(optarg, ",");
+             NULL != what;
+             what = strtok(NULL, ",")) {
+          if (0 == strcmp(what, "program")) {
+            suppress |= M2M_SUPPRESS_PROGRAM;
+          }
+          else if (0 == strcmp(what, "cc")) {
+            suppress |= M2M_SUPPRESS_CC;
+          }
+          else if (0 == strcmp(what, "bend")) {
+            suppress |= M2M_SUPPRESS_BEND;
+          }
+          else if (0 == strcmp(what, "pressure")) {
+            suppress |= M2M_SUPPRESS_PRESSURE;
+          }
+          else if (0 == strcmp(what, "all")) {
+            suppress |= M2M_SUPPRESS_ALL;
+          }
+          else {
+            error("Can suppress program, cc, bend, pressure or all, not "
+                  "'%s'.", what);
+          }
+        }
+        /*
+         * Like the program repeat prevention, this needs MIDI in and out.
+         */
+        capabilities = CB_ALSA_MIDI_IN | CB_ALSA_MIDI_OUT;
+        break;
+      }
+      case 'S': {
+        state_file = optarg;
+        capabilities = CB_ALSA_MIDI_IN | CB_ALSA_MIDI_OUT;
+        break;
+      }
       case 'f': {
         if (optarg[0] == '-') {
           error("Message type required for -f, --filter%c", '\n');
@@ -947,8 +1558,140 @@ int main(int argc, char *argv[]) {
         filter = lookup_capabilities(optarg);
         break;
       }
+      case 'b': {
+        long usecs = 0;
+        batch.size = BATCH_DEFAULT_SIZE;
+        if (NULL != optarg) {
+          if (1 > sscanf(optarg, "%d,%ld", &batch.size, &usecs)) {
+            error("Invalid batch size '%s'.", optarg);
+          }
+          if ((1 > batch.size) || (0 > usecs)) {
+            error("Batch size must be positive and age not negative ('%s').",
+                  optarg);
+          }
+          if (BATCH_MAX_SIZE < batch.size) {
+            error("At most %d events can be batched.", BATCH_MAX_SIZE);
+          }
+        }
+        batch.age = (uint64_t)usecs * 1000;
+        break;
+      }
+      case 'q': {
+        char policy[16] = "supersede";
+        queue_size = QUEUE_DEFAULT_SIZE;
+        if ((NULL != optarg) &&
+            ((1 > sscanf(optarg, "%d,%15s", &queue_size, policy)) ||
+             (1 > queue_size))) {
+          error("Invalid output queue size '%s'.", optarg);
+        }
+        if (0 == strcmp(policy, "supersede")) {
+          queue_policy = OUTQ_SUPERSEDE;
+        }
+        else if (0 == strcmp(policy, "oldest")) {
+          queue_policy = OUTQ_OLDEST;
+        }
+        else if (0 == strcmp(policy, "newest")) {
+          queue_policy = OUTQ_NEWEST;
+        }
+        else {
+          error("Can drop supersede, oldest or newest, not '%s'.", policy);
+        }
+        break;
+      }
+      case 'P': {
+        if ((1 != sscanf(optarg, "%d", &pool_size)) || (1 > pool_size)) {
+          error("Invalid sequencer pool size '%s'.", optarg);
+        }
+        break;
+      }
+      case 'B': {
+        output_buffer_size = -1;
+        if ((1 > sscanf(optarg, "%d,%d", &input_buffer_size,
+                        &output_buffer_size)) ||
+            (1 > input_buffer_size) || (0 == output_buffer_size) ||
+            (-1 > output_buffer_size)) {
+          error("Invalid sequencer buffer sizes '%s'.", optarg);
+        }
+        if (-1 == output_buffer_size) {
+          output_buffer_size = input_buffer_size;
+        }
+        break;
+      }
+      case 'r': {
+        realtime_priority = REALTIME_DEFAULT_PRIORITY;
+        if ((NULL != optarg) &&
+            ((1 != sscanf(optarg, "%d", &realtime_priority)) ||
+             (1 > realtime_priority) || (99 < realtime_priority))) {
+          error("Realtime priority must be between 1 and 99, not '%s'.",
+                optarg);
+        }
+        break;
+      }
+      case 'a': {
+        if ((1 != sscanf(optarg, "%d", &realtime_cpu)) || (0 > realtime_cpu)) {
+          error("Invalid CPU number '%s'.", optarg);
+        }
+        break;
+      }
+      case 'i': {
+        rawmidi_in_device = optarg;
+        break;
+      }
+      case 'o': {
+        rawmidi_out_device = optarg;
+        break;
+      }
+      case 'T': {
+        char how[8] = "port";
+        if ((1 > sscanf(optarg, "%d,%7s", &threads, how)) || (1 > threads)) {
+          error("Invalid number of threads '%s'.", optarg);
+        }
+        if (0 == strcmp(how, "channel")) {
+          shard = SHARD_BY_CHANNEL;
+        }
+        else if (0 != strcmp(how, "port")) {
+          error("Threads can be sharded by port or channel, not '%s'.", how);
+        }
+        break;
+      }
+      case 'l': {
+        measure_latency = 1;
+        break;
+      }
+      case 'R': {
+        replay_file = optarg;
+        break;
+      }
+      case 'C': {
+        check = 1;
+        break;
+      }
+      case 't': {
+        char what[16];
+        thin_policy policy = { 0, 0 };
+        int type;
+        if ((2 > sscanf(optarg, "%15[a-z]:%d,%d",
+                        what, &policy.rate, &policy.delta)) ||
+            (0 > policy.rate) || (0 > policy.delta) ||
+            ((0 == policy.rate) && (0 == policy.delta))) {
+          error("Invalid thinning '%s', expected <what>:<rate>[,<delta>].",
+                optarg);
+        }
+        for (type = 0; type < THIN_TYPES; type++) {
+          static const char *names[THIN_TYPES] = { "cc", "bend", "pressure" };
+          if ((0 == strcmp(what, "all")) || (0 == strcmp(what, names[type]))) {
+            thin_policies[type] = policy;
+            thinning = 1;
+          }
+        }
+        if (0 == thinning) {
+          error("Can thin cc, bend, pressure or all, not '%s'.", what);
+        }
+        break;
+      }
       case 'n': {
         strncpy(port_name, optarg, 254);
+        client_name_given = 1;
         break;
       }
 #ifdef USE_JACK
@@ -956,6 +1699,19 @@ int main(int argc, char *argv[]) {
         use_jack = 1;
         break;
       }
+      case 'J': {
+        use_jack = 1;
+        use_jack_midi = 1;
+        break;
+      }
+      case 'w': {
+        if ((1 > sscanf(optarg, "%d,%d", &wheel_interval,
+                        &wheel_acceleration)) ||
+            (0 > wheel_interval) || (0 > wheel_acceleration)) {
+          error("Invalid jog wheel interval '%s'.", optarg);
+        }
+        break;
+      }
 #endif
       case 'd': {
         debug_enable();
@@ -968,108 +1724,569 @@ int main(int argc, char *argv[]) {
     }
   }
 
+  /*
+   * Only validate the configuration files and exit, for deploy scripts.
+   */
+  if (1 == check) {
+    if (0 == nconfig_files) {
+      error("No configuration file to check was provided%c", '.');
+    }
+#ifdef USE_JACK
+    exit((0 == midi2midi_check(config_files, nconfig_files, use_jack)) ?
+         EXIT_SUCCESS : EXIT_FAILURE);
+#else
+    exit((0 == midi2midi_check(config_files, nconfig_files)) ?
+         EXIT_SUCCESS : EXIT_FAILURE);
+#endif
+  }
+
   /*
    * Make sure that the all so important configuration file is provided.
    */
-  if ((config_file == NULL) && (strlen(port_name) ==  0)) {
+  if ((0 == nconfig_files) && (strlen(port_name) ==  0)) {
     error("No configuration file, nor a client name was provided use %s "
           "-h for more information.",
           app_name);
   }
 
+  if ((NULL == rawmidi_in_device) != (NULL == rawmidi_out_device)) {
+    error("Both a rawmidi input and output device must be given%c", '.');
+  }
+
+#ifdef USE_JACK
+  if ((1 == use_jack_midi) && (NULL != rawmidi_in_device)) {
+    error("Jack MIDI ports and rawmidi devices can not be combined%c", '.');
+  }
+
+  if ((1 == use_jack_midi) && (1 == measure_latency)) {
+    error("Latency can not be measured with Jack MIDI ports, events there "
+          "are delayed by exactly one Jack period%c", '.');
+  }
+#endif
+
+  if ((0 <= realtime_cpu) && (0 == realtime_priority)) {
+    error("Pinning to a CPU requires the realtime mode (-r)%c", '.');
+  }
+
+  if ((0 != threads) && (NULL != rawmidi_in_device)) {
+    error("Worker threads need the ALSA sequencer%c", '.');
+  }
+
+  if ((0 != queue_size) &&
+      ((NULL != rawmidi_in_device) || (0 != threads) || (0 != batch.size))) {
+    error("Output queueing needs the ALSA sequencer without worker threads "
+          "or batching%c", '.');
+  }
+
+#ifdef USE_JACK
+  if (((0 != pool_size) || (0 != input_buffer_size)) &&
+      ((NULL != rawmidi_in_device) || (1 == use_jack_midi))) {
+#else
+  if (((0 != pool_size) || (0 != input_buffer_size)) &&
+      (NULL != rawmidi_in_device)) {
+#endif
+    error("Pool and buffer sizes are only for the ALSA sequencer%c", '.');
+  }
+
+#ifdef USE_JACK
+  if ((0 != queue_size) && (1 == use_jack_midi)) {
+    error("Output queueing needs the ALSA sequencer, not Jack MIDI ports%c",
+          '.');
+  }
+#endif
+
+  /*
+   * A state file is only kept for suppressing, so without -s it suppresses
+   * everything that would not change the receivers.
+   */
+  if ((NULL != state_file) && (0 == suppress)) {
+    suppress = M2M_SUPPRESS_ALL;
+  }
+
+  /*
+   * The receiver state cache of an instance must only be used by one
+   * worker. Sharded by port all events of an instance go to the same
+   * worker, sharded by channel its channels are spread over several.
+   */
+  if ((0 != suppress) && (0 != threads) && (SHARD_BY_PORT != shard)) {
+    error("Unchanged messages can not be suppressed with threads sharded by "
+          "channel%c", '.');
+  }
+
+  if ((0 != threads) && (1 == thinning)) {
+    error("Continuous data can not be thinned out with worker threads%c",
+          '.');
+  }
+
+#ifdef USE_JACK
+  if ((1 == use_jack_midi) && (1 == thinning)) {
+    error("Continuous data can not be thinned out with Jack MIDI ports%c",
+          '.');
+  }
+#endif
+
+  if ((NULL != replay_file) && (1 < nconfig_files)) {
+    error("Only one configuration file can be replayed at a time%c", '.');
+  }
+
+#ifdef USE_JACK
+  if ((1 < nconfig_files) &&
+      ((NULL != rawmidi_in_device) || (1 == use_jack_midi))) {
+#else
+  if ((1 < nconfig_files) && (NULL != rawmidi_in_device)) {
+#endif
+    error("Several configuration files need the ALSA sequencer%c", '.');
+  }
+
+  /*
+   * Debug messages are written from the event path too, so they are
+   * printed by a thread of their own. It is started before the realtime
+   * scheduling is set up, so that it does not get it.
+   */
+  if (debug_is_enabled()) {
+    debug_async_start();
+  }
+
+  m2m_options_init(&options, filter, suppress);
+
   /*
-   * Read the configuration file and get all the essential information.
+   * Read the configuration files and get all the essential information.
+   * Without any configuration file there is still one instance doing
+   * program change prevention and filtering.
    */
+  ninstances = (0 == nconfig_files) ? 1 : nconfig_files;
+  if (NULL == (instances = calloc(ninstances, sizeof(instance)))) {
+    error("Could not allocate %d translation instances.", ninstances);
+  }
+  for (i = 0; i < ninstances; i++) {
+    instance *inst = &instances[i];
+    inst->config_file = (0 == nconfig_files) ? NULL : config_files[i];
+    inst->in_port = inst->out_port = -1;
+    strcpy(inst->port_name, port_name);
+    if (1 == measure_latency) {
+      int type;
+      if (NULL == (inst->latency = malloc(TT_COUNT * sizeof(histogram)))) {
+        error("Could not allocate latency histograms for instance %d.", i);
+      }
+      for (type = 0; type < TT_COUNT; type++) {
+        histogram_init(&inst->latency[type]);
+      }
+    }
 #ifdef USE_JACK
-  capabilities = translation_table_init(config_file,
-                                        note_table,
-                                        cc_table,
-                                        port_name,
-                                        capabilities,
-                                        use_jack);
+    inst->rules = config_rules(inst->config_file,
+                               inst->port_name,
+                               &capabilities,
+                               message,
+                               use_jack);
 #else
-  capabilities = translation_table_init(config_file,
-                                        note_table,
-                                        cc_table,
-                                        port_name,
-                                        capabilities);
+    inst->rules = config_rules(inst->config_file,
+                               inst->port_name,
+                               &capabilities,
+                               message);
 #endif
+    if (NULL == inst->rules) {
+      error("%s", message);
+    }
+    m2m_state_init(&inst->state, &options, NULL);
+    if (1 == thinning) {
+      inst->thin = thin_new(thin_policies);
+    }
+    if (0 != queue_size) {
+      inst->queue = outq_new(queue_size, queue_policy);
+    }
+  }
+
+  /*
+   * Every output port remembers what its receiver was sent, in the state
+   * file when one is given. A replay sends nothing to any receiver, so it
+   * must not touch the state file.
+   */
+  if (0 != suppress) {
+    caches = cache_new((NULL == replay_file) ? state_file : NULL,
+                       ninstances);
+    for (i = 0; i < ninstances; i++) {
+      instances[i].state.cache = &caches[i];
+    }
+  }
+
+  /*
+   * Unless a client name is given with -n, a single instance names the
+   * client after itself and a host of several instances uses the program
+   * name.
+   */
+  if (0 == client_name_given) {
+    strcpy(port_name, (1 == ninstances) ? instances[0].port_name : APPNAME);
+  }
 
   if (MT_NONE != filter) {
     capabilities |= CB_ALSA_MIDI_IN;
     capabilities |= CB_ALSA_MIDI_OUT;
   }
 
+  /*
+   * A replay needs no MIDI devices at all, it is done before any are
+   * opened.
+   */
+  if (NULL != replay_file) {
+    midi2midi_replay(replay_file, &instances[0]);
+    for (i = 0; i < ninstances; i++) {
+      image_delete(instances[i].rules);
+      free(instances[i].latency);
+      thin_delete(instances[i].thin);
+      outq_delete(instances[i].queue);
+    }
+    free(instances);
+    cache_delete(caches, ninstances);
+    exit(EXIT_SUCCESS);
+  }
+
+  /*
+   * Ensure a clean exit in as many situations as possible. This blocks the
+   * signals, so it must be done before any library starts its own threads.
+   */
+  quit_fd = quit_init();
+  loop = event_loop_new();
+  event_loop_add(loop, quit_fd, POLLIN, SOURCE_SIGNAL);
+
+  /*
+   * Every thread translating events is a reader of the rules, so that a
+   * reload knows when the old rules can be freed.
+   */
+  rules_rcu = rcu_new();
+  reader = rcu_register(rules_rcu);
+
   /*
    * Set-up ALSA MIDI and Jack Transport depending on how the program
    * instance is set-up.
    */
-  if (CB_ALSA_MIDI_IN == (capabilities & (CB_ALSA_MIDI_IN))) {
-    in_port_ptr = &in_port;
+  use_alsa_in = (CB_ALSA_MIDI_IN == (capabilities & (CB_ALSA_MIDI_IN)));
+  use_alsa_out = (CB_ALSA_MIDI_OUT == (capabilities & (CB_ALSA_MIDI_OUT)));
+#ifdef USE_JACK
+  if (1 == use_jack_midi) {
+    /*
+     * All MIDI goes through the Jack ports, so no ALSA ports are needed.
+     */
+    use_alsa_in = use_alsa_out = 0;
   }
-  if (CB_ALSA_MIDI_OUT == (capabilities & (CB_ALSA_MIDI_OUT))) {
-    out_port_ptr = &out_port;
+#endif
+  if (NULL != rawmidi_in_device) {
+    /*
+     * Hardware to hardware translation, no sequencer involved at all.
+     */
+    rawmidi_new(&rawmidi_in, &rawmidi_out,
+                rawmidi_in_device, rawmidi_out_device);
+    midi_stream_parser_init(&parser);
+    midi_stream_encoder_init(&encoder);
+    pfd = rawmidi_poller_new(rawmidi_in, &npfd);
+    for (i = 0; i < npfd; i++) {
+      event_loop_add(loop, pfd[i].fd, pfd[i].events, SOURCE_RAWMIDI);
+    }
   }
-  if ((NULL != in_port_ptr) || (NULL != out_port_ptr)) {
-    seq_handle = sequencer_new(in_port_ptr, out_port_ptr, port_name);
+  else if (use_alsa_in || use_alsa_out) {
+    /*
+     * One ALSA client with a pair of ports per instance.
+     */
+    seq_handle = sequencer_new(NULL, NULL, port_name);
+    sequencer_buffers(seq_handle, pool_size, input_buffer_size,
+                      output_buffer_size);
+    for (i = 0; i < ninstances; i++) {
+      instance *inst = &instances[i];
+      sequencer_ports_new(seq_handle,
+                          use_alsa_in ? &inst->in_port : NULL,
+                          use_alsa_out ? &inst->out_port : NULL,
+                          inst->port_name);
+      if ((0 <= inst->in_port) && (256 > inst->in_port)) {
+        port_map[inst->in_port] = inst;
+      }
+      if ((0 <= inst->out_port) && (256 > inst->out_port)) {
+        out_map[inst->out_port] = inst;
+      }
+    }
     pfd = sequencer_poller_new(seq_handle, &npfd);
+    for (i = 0; i < npfd; i++) {
+      event_loop_add(loop, pfd[i].fd, pfd[i].events, SOURCE_SEQUENCER);
+    }
+    /*
+     * With output queues a full output never blocks, what can not be
+     * written waits in the queues until the sequencer has room.
+     */
+    if (0 != queue_size) {
+      snd_seq_nonblock(seq_handle, 1);
+    }
   }
 #ifdef USE_JACK
-  if (1 == use_jack) {
+  if (1 == use_jack_midi) {
+    /*
+     * The translation runs in the process callback of this client, which
+     * also controls the Jack transport.
+     */
+    jm = jack_midi_new(port_name,
+                       midi2midi_jack_translate,
+                       &jack_context,
+                       rules_rcu);
+    transport = jack_midi_transport(jm);
+    jack_context.transport = transport;
+    jack_context.inst = &instances[0];
+  }
+  else if (1 == use_jack) {
     if (CB_JACK_TRANSPORT_OUT == (capabilities & CB_JACK_TRANSPORT_OUT)) {
-      jack_client = jack_transport_new(port_name);
+      transport = jack_transport_new(port_name);
+    }
+  }
+  if (NULL != transport) {
+    jack_transport_wheel(transport, wheel_interval * 1000,
+                         wheel_acceleration);
+  }
+#endif
+
+  /*
+   * Configuration files are reloaded on SIGHUP, in the background. The
+   * reload thread is started before the realtime scheduling is set up, so
+   * that parsing a configuration never competes with the event path.
+   */
+  rules_context.instances = instances;
+  rules_context.ninstances = ninstances;
+  rules_context.capabilities = capabilities;
+  rules_context.rcu = rules_rcu;
+#ifdef USE_JACK
+  rules_context.use_jack = use_jack;
+#endif
+  reloader = reload_new(midi2midi_reload, &rules_context);
+
+  /*
+   * Everything is allocated now, so this is the place to lock it down and
+   * check that the event path will not page-fault once running.
+   */
+  if (0 != realtime_priority) {
+    realtime_status status = realtime_init(realtime_priority, realtime_cpu);
+    long faults;
+
+    for (i = 0; i < ninstances; i++) {
+      midi2midi_warmup(instance_rules(&instances[i]), &options);
+    }
+    faults = 0;
+    for (i = 0; i < ninstances; i++) {
+      faults += midi2midi_warmup(instance_rules(&instances[i]), &options);
+    }
+
+    if (RT_MEMORY_LOCKED != (status & RT_MEMORY_LOCKED)) {
+      warning("Realtime mode without locked memory, the event path may "
+              "page-fault%c", '.');
+    }
+    else if (0 != faults) {
+      warning("The event path caused %ld page faults after locking memory.",
+              faults);
+    }
+    else {
+      debug("The event path caused no page faults after locking memory%c",
+            '.');
     }
+
+    if (RT_SCHED_FIFO != (status & RT_SCHED_FIFO)) {
+      warning("Fell back to normal scheduling, expect MIDI timing jitter%c",
+              '.');
+    }
+  }
+
+#ifdef USE_JACK
+  if (NULL != jm) {
+    jack_midi_activate(jm);
   }
 #endif
 
   /*
-   * Ensure a clean exit in as many situations as possible.
+   * The worker threads are started after the realtime set-up so they
+   * inherit its scheduling and locked memory.
+   */
+  if ((0 != threads) && (NULL != seq_handle)) {
+    pipe_context.seq_handle = seq_handle;
+#ifdef USE_JACK
+    pipe_context.transport = transport;
+    pipe_context.use_jack = use_jack;
+#endif
+    pipe_context.port_map = port_map;
+    pipe_context.out_map = out_map;
+    pipe_context.batch = &batch;
+    pipe = pipeline_new(threads,
+                        shard,
+                        midi2midi_pipeline_translate,
+                        midi2midi_pipeline_output,
+                        midi2midi_pipeline_flush,
+                        &pipe_context,
+                        rules_rcu);
+  }
+
+  /*
+   * Held continuous data is written from the main loop when it is due.
    */
-  quit_init(quit_callback);
+  thin_ctx.seq_handle = seq_handle;
+  thin_ctx.batch = &batch;
+  thin_ctx.inst = NULL;
+  thin_ctx.rawmidi_out = rawmidi_out;
+  thin_ctx.encoder = &encoder;
 
   /*
    * Main loop.
    */
   while (!quit) {
+    int sources[8];
+    int nsources;
+
+    rcu_offline(rules_rcu, reader);
+    nsources = event_loop_wait(loop, sources, 8);
+    rcu_online(rules_rcu, reader);
+
+    for (i = 0; i < nsources; i++) {
+      switch (sources[i]) {
+        case SOURCE_SEQUENCER: {
+#ifdef USE_JACK
+          midi2midi(seq_handle,
+                    transport,
+                    port_map,
+                    &batch,
+                    pipe,
+                    use_jack);
+#else
+          midi2midi(seq_handle,
+                    port_map,
+                    &batch,
+                    pipe);
+#endif
+          break;
+        }
+        case SOURCE_RAWMIDI: {
 #ifdef USE_JACK
-    midi2midi(seq_handle,
-              jack_client,
-              pfd,
-              npfd,
-              in_port,
-              out_port,
-              note_table,
-              cc_table,
-              program_change_prevention,
-              filter,
-              use_jack);
+          midi2midi_rawmidi(rawmidi_in,
+                            rawmidi_out,
+                            &parser,
+                            &encoder,
+                            transport,
+                            &instances[0],
+                            use_jack);
 #else
-    midi2midi(seq_handle,
-              pfd,
-              npfd,
-              in_port,
-              out_port,
-              note_table,
-              cc_table,
-              program_change_prevention,
-              filter);
+          midi2midi_rawmidi(rawmidi_in,
+                            rawmidi_out,
+                            &parser,
+                            &encoder,
+                            &instances[0]);
 #endif
+          break;
+        }
+        case SOURCE_SIGNAL: {
+          int sig = quit_signal(quit_fd);
+          if (SIGUSR1 == sig) {
+            if (1 == measure_latency) {
+              latency_report(instances, ninstances);
+            }
+            if (1 == thinning) {
+              thin_report(instances, ninstances);
+            }
+            if (0 != queue_size) {
+              queue_report(instances, ninstances);
+            }
+            if (NULL != seq_handle) {
+              overrun_report(seq_handle, instances, ninstances);
+            }
+          }
+          else if (SIGHUP == sig) {
+            debug("Reloading configuration files%c", '.');
+            reload_request(reloader);
+          }
+          else if (0 != sig) {
+            debug("Quitting with signal %d", sig);
+            quit = 1;
+          }
+          break;
+        }
+        case EVENT_LOOP_TIMER: {
+          break;
+        }
+        default: {
+          /*
+           * Internal wake-up, the loop condition is checked again.
+           */
+          break;
+        }
+      }
+    }
+
+    /*
+     * Whatever woke the loop up, write the held continuous data that is
+     * due and wake up again when the next is.
+     */
+    if (1 == thinning) {
+      event_loop_timer(loop,
+                       midi2midi_thin_flush(&thin_ctx, instances, ninstances));
+    }
+
+    /*
+     * Write what is queued, and wait for room in the sequencer output only
+     * while something is left.
+     */
+    if ((0 != queue_size) && (NULL != seq_handle)) {
+      int waiting = (0 != queue_flush(seq_handle, instances, ninstances));
+      if (waiting != output_waiting) {
+        for (i = 0; i < npfd; i++) {
+          event_loop_modify(loop, pfd[i].fd,
+                            waiting ? (pfd[i].events | POLLOUT) :
+                            pfd[i].events,
+                            SOURCE_SEQUENCER);
+        }
+        output_waiting = waiting;
+      }
+    }
   }
 
   /*
    * Cleanup resources and return memory to system.
    */
-  if ((NULL != in_port_ptr) || (NULL != out_port_ptr)) {
+  rcu_offline(rules_rcu, reader);
+  reload_delete(reloader);
+  if (NULL != pipe) {
+    pipeline_delete(pipe);
+  }
+  if (1 == measure_latency) {
+    latency_report(instances, ninstances);
+  }
+  if (1 == thinning) {
+    thin_report(instances, ninstances);
+  }
+  if (0 != queue_size) {
+    queue_report(instances, ninstances);
+  }
+  if ((NULL != seq_handle) &&
+      ((0 != input_overruns) || (0 < sequencer_lost(seq_handle)))) {
+    overrun_report(seq_handle, instances, ninstances);
+  }
+  if (NULL != rawmidi_in) {
+    rawmidi_poller_delete(pfd);
+    rawmidi_delete(rawmidi_in, rawmidi_out);
+  }
+  else if (NULL != seq_handle) {
     sequencer_poller_delete(pfd);
     sequencer_delete(seq_handle);
   }
+  event_loop_delete(loop);
+  quit_delete(quit_fd);
 #ifdef USE_JACK
-  if (use_jack) {
-    if (NULL != jack_client) {
-      jack_transport_delete(jack_client);
+  if (NULL != jm) {
+    jack_midi_delete(jm);
+  }
+  else if (use_jack) {
+    if (NULL != transport) {
+      jack_transport_delete(transport);
     }
   }
 #endif
+  for (i = 0; i < ninstances; i++) {
+    image_delete(instances[i].rules);
+    free(instances[i].latency);
+    thin_delete(instances[i].thin);
+    outq_delete(instances[i].queue);
+  }
+  free(instances);
+  cache_delete(caches, ninstances);
+  rcu_delete(rules_rcu);
 
   /*
    * Make a clean exit.
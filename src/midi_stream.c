@@ -0,0 +1,362 @@
+/*
+ * midi_stream.c
+ *
+ * Copyright (C)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * About
+ * -----
+ *
+ * Author: AiO <aio at aio dot nu>
+ *
+ * This is a simplified implementation for converting a raw MIDI byte stream
+ * into ALSA sequencer events and back again, with running status in both
+ * directions.
+ *
+ */
+
+#include <string.h>
+#include <alsa/asoundlib.h>
+
+#include "midi_stream.h"
+
+
+/*
+ * Get the number of data bytes following a status byte.
+ */
+static int midi_stream_data_length(unsigned char status) {
+  switch (status & 0xF0) {
+    case 0x80:
+    case 0x90:
+    case 0xA0:
+    case 0xB0:
+    case 0xE0: {
+      return 2;
+    }
+    case 0xC0:
+    case 0xD0: {
+      return 1;
+    }
+    default: {
+      break;
+    }
+  }
+
+  switch (status) {
+    case 0xF1:
+    case 0xF3: {
+      return 1;
+    }
+    case 0xF2: {
+      return 2;
+    }
+    default: {
+      return 0;
+    }
+  }
+}
+
+
+/*
+ * Fill in an event from a complete message. Returns 0 for messages that
+ * have no sequencer event representation.
+ */
+static int midi_stream_event(unsigned char status,
+                             const unsigned char *data,
+                             snd_seq_event_t *ev) {
+  snd_seq_ev_clear(ev);
+
+  if (status < 0xF0) {
+    ev->data.note.channel = status & 0x0F;
+  }
+
+  switch (status & 0xF0) {
+    case 0x80:
+    case 0x90:
+    case 0xA0: {
+      ev->type = (0x80 == (status & 0xF0)) ? SND_SEQ_EVENT_NOTEOFF :
+                 (0x90 == (status & 0xF0)) ? SND_SEQ_EVENT_NOTEON :
+                 SND_SEQ_EVENT_KEYPRESS;
+      ev->data.note.note = data[0];
+      ev->data.note.velocity = data[1];
+      return 1;
+    }
+    case 0xB0: {
+      ev->type = SND_SEQ_EVENT_CONTROLLER;
+      ev->data.control.param = data[0];
+      ev->data.control.value = data[1];
+      return 1;
+    }
+    case 0xC0:
+    case 0xD0: {
+      ev->type = (0xC0 == (status & 0xF0)) ? SND_SEQ_EVENT_PGMCHANGE :
+                 SND_SEQ_EVENT_CHANPRESS;
+      ev->data.control.value = data[0];
+      return 1;
+    }
+    case 0xE0: {
+      ev->type = SND_SEQ_EVENT_PITCHBEND;
+      ev->data.control.value = (data[0] | (data[1] << 7)) - 8192;
+      return 1;
+    }
+    default: {
+      break;
+    }
+  }
+
+  switch (status) {
+    case 0xF1: ev->type = SND_SEQ_EVENT_QFRAME; break;
+    case 0xF2: ev->type = SND_SEQ_EVENT_SONGPOS; break;
+    case 0xF3: ev->type = SND_SEQ_EVENT_SONGSEL; break;
+    case 0xF6: ev->type = SND_SEQ_EVENT_TUNE_REQUEST; break;
+    case 0xF8: ev->type = SND_SEQ_EVENT_CLOCK; break;
+    case 0xFA: ev->type = SND_SEQ_EVENT_START; break;
+    case 0xFB: ev->type = SND_SEQ_EVENT_CONTINUE; break;
+    case 0xFC: ev->type = SND_SEQ_EVENT_STOP; break;
+    case 0xFE: ev->type = SND_SEQ_EVENT_SENSING; break;
+    case 0xFF: ev->type = SND_SEQ_EVENT_RESET; break;
+    default: return 0;
+  }
+
+  if (0xF2 == status) {
+    ev->data.control.value = data[0] | (data[1] << 7);
+  }
+  else if ((0xF1 == status) || (0xF3 == status)) {
+    ev->data.control.value = data[0];
+  }
+
+  return 1;
+}
+
+
+/*
+ * Turn the collected SysEx bytes into a variable length event.
+ */
+static int midi_stream_sysex(midi_stream_parser *parser,
+                             snd_seq_event_t *ev) {
+  snd_seq_ev_clear(ev);
+  snd_seq_ev_set_sysex(ev, parser->sysex_len, parser->sysex);
+  parser->sysex_len = 0;
+
+  return 1;
+}
+
+
+/*
+ * Reset a parser to its initial state.
+ */
+void midi_stream_parser_init(midi_stream_parser *parser) {
+  memset(parser, 0, sizeof(*parser));
+}
+
+
+/*
+ * Feed one byte to the parser.
+ */
+int midi_stream_parse(midi_stream_parser *parser,
+                      unsigned char byte,
+                      snd_seq_event_t *ev) {
+  /*
+   * Realtime messages may show up anywhere, even in the middle of another
+   * message, and do not affect the running status.
+   */
+  if (byte >= 0xF8) {
+    return midi_stream_event(byte, NULL, ev);
+  }
+
+  if (byte & 0x80) {
+    if (parser->in_sysex) {
+      parser->in_sysex = 0;
+      if (0xF7 == byte) {
+        parser->sysex[parser->sysex_len++] = byte;
+        return midi_stream_sysex(parser, ev);
+      }
+      /*
+       * Any other status byte aborts an unterminated SysEx message.
+       */
+      parser->sysex_len = 0;
+    }
+
+    if (0xF0 == byte) {
+      parser->in_sysex = 1;
+      parser->sysex[0] = byte;
+      parser->sysex_len = 1;
+      parser->status = 0;
+      return 0;
+    }
+
+    parser->status = byte;
+    parser->count = 0;
+    parser->expected = midi_stream_data_length(byte);
+
+    if (0 == parser->expected) {
+      /*
+       * Tune request and undefined system common messages have no data
+       * and cancel the running status.
+       */
+      parser->status = 0;
+      return midi_stream_event(byte, NULL, ev);
+    }
+    return 0;
+  }
+
+  if (parser->in_sysex) {
+    parser->sysex[parser->sysex_len++] = byte;
+    if (MIDI_STREAM_SYSEX_SIZE - 1 == parser->sysex_len) {
+      /*
+       * Leave room for the terminating byte and deliver what we have.
+       */
+      return midi_stream_sysex(parser, ev);
+    }
+    return 0;
+  }
+
+  /*
+   * Data bytes without any status to run on are dropped.
+   */
+  if (0 == parser->status) {
+    return 0;
+  }
+
+  parser->data[parser->count++] = byte;
+  if (parser->count < parser->expected) {
+    return 0;
+  }
+  parser->count = 0;
+
+  if (parser->status >= 0xF0) {
+    byte = parser->status;
+    parser->status = 0;
+    return midi_stream_event(byte, parser->data, ev);
+  }
+
+  return midi_stream_event(parser->status, parser->data, ev);
+}
+
+
+/*
+ * Reset an encoder to its initial state.
+ */
+void midi_stream_encoder_init(midi_stream_encoder *encoder) {
+  encoder->status = 0;
+}
+
+
+/*
+ * Encode an event into buf.
+ */
+size_t midi_stream_encode(midi_stream_encoder *encoder,
+                          const snd_seq_event_t *ev,
+                          unsigned char *buf,
+                          size_t size) {
+  unsigned char msg[3];
+  size_t len;
+  int value;
+
+  switch (ev->type) {
+    case SND_SEQ_EVENT_NOTEOFF:
+    case SND_SEQ_EVENT_NOTEON:
+    case SND_SEQ_EVENT_KEYPRESS: {
+      msg[0] = (SND_SEQ_EVENT_NOTEOFF == ev->type) ? 0x80 :
+               (SND_SEQ_EVENT_NOTEON == ev->type) ? 0x90 : 0xA0;
+      msg[0] |= ev->data.note.channel & 0x0F;
+      msg[1] = ev->data.note.note & 0x7F;
+      msg[2] = ev->data.note.velocity & 0x7F;
+      len = 3;
+      break;
+    }
+    case SND_SEQ_EVENT_CONTROLLER: {
+      msg[0] = 0xB0 | (ev->data.control.channel & 0x0F);
+      msg[1] = ev->data.control.param & 0x7F;
+      msg[2] = ev->data.control.value & 0x7F;
+      len = 3;
+      break;
+    }
+    case SND_SEQ_EVENT_PGMCHANGE:
+    case SND_SEQ_EVENT_CHANPRESS: {
+      msg[0] = (SND_SEQ_EVENT_PGMCHANGE == ev->type) ? 0xC0 : 0xD0;
+      msg[0] |= ev->data.control.channel & 0x0F;
+      msg[1] = ev->data.control.value & 0x7F;
+      len = 2;
+      break;
+    }
+    case SND_SEQ_EVENT_PITCHBEND: {
+      value = ev->data.control.value + 8192;
+      msg[0] = 0xE0 | (ev->data.control.channel & 0x0F);
+      msg[1] = value & 0x7F;
+      msg[2] = (value >> 7) & 0x7F;
+      len = 3;
+      break;
+    }
+    case SND_SEQ_EVENT_QFRAME:
+    case SND_SEQ_EVENT_SONGSEL: {
+      msg[0] = (SND_SEQ_EVENT_QFRAME == ev->type) ? 0xF1 : 0xF3;
+      msg[1] = ev->data.control.value & 0x7F;
+      len = 2;
+      break;
+    }
+    case SND_SEQ_EVENT_SONGPOS: {
+      msg[0] = 0xF2;
+      msg[1] = ev->data.control.value & 0x7F;
+      msg[2] = (ev->data.control.value >> 7) & 0x7F;
+      len = 3;
+      break;
+    }
+    case SND_SEQ_EVENT_TUNE_REQUEST: msg[0] = 0xF6; len = 1; break;
+    case SND_SEQ_EVENT_CLOCK: msg[0] = 0xF8; len = 1; break;
+    case SND_SEQ_EVENT_START: msg[0] = 0xFA; len = 1; break;
+    case SND_SEQ_EVENT_CONTINUE: msg[0] = 0xFB; len = 1; break;
+    case SND_SEQ_EVENT_STOP: msg[0] = 0xFC; len = 1; break;
+    case SND_SEQ_EVENT_SENSING: msg[0] = 0xFE; len = 1; break;
+    case SND_SEQ_EVENT_RESET: msg[0] = 0xFF; len = 1; break;
+    case SND_SEQ_EVENT_SYSEX: {
+      if (ev->data.ext.len > size) {
+        return 0;
+      }
+      memcpy(buf, ev->data.ext.ptr, ev->data.ext.len);
+      encoder->status = 0;
+      return ev->data.ext.len;
+    }
+    default: {
+      return 0;
+    }
+  }
+
+  /*
+   * Channel messages repeating the previous status byte leave it out.
+   */
+  if ((msg[0] < 0xF0) && (msg[0] == encoder->status)) {
+    if (len - 1 > size) {
+      return 0;
+    }
+    memcpy(buf, &msg[1], len - 1);
+    return len - 1;
+  }
+
+  if (len > size) {
+    return 0;
+  }
+  memcpy(buf, msg, len);
+
+  if (msg[0] < 0xF0) {
+    encoder->status = msg[0];
+  }
+  else if (msg[0] < 0xF8) {
+    encoder->status = 0;
+  }
+
+  return len;
+}
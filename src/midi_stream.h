@@ -0,0 +1,95 @@
+/*
+ * midi_stream.h
+ *
+ * Copyright (C)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * About
+ * -----
+ *
+ * Author: AiO <aio at aio dot nu>
+ *
+ * This is a simplified API for converting a raw MIDI byte stream into ALSA
+ * sequencer events and back again, with running status in both directions.
+ *
+ */
+
+#ifndef _MIDI_STREAM_H_
+#define _MIDI_STREAM_H_
+
+#include <stddef.h>
+#include <alsa/asoundlib.h>
+
+/*
+ * Largest SysEx chunk delivered as one event. Longer messages are split
+ * into several events the same way the ALSA sequencer does it.
+ */
+#define MIDI_STREAM_SYSEX_SIZE 256
+
+/*
+ * Parser state. Initialise with midi_stream_parser_init().
+ */
+typedef struct {
+  unsigned char status;
+  unsigned char data[2];
+  int count;
+  int expected;
+  int in_sysex;
+  size_t sysex_len;
+  unsigned char sysex[MIDI_STREAM_SYSEX_SIZE];
+} midi_stream_parser;
+
+/*
+ * Encoder state. Initialise with midi_stream_encoder_init().
+ */
+typedef struct {
+  unsigned char status;
+} midi_stream_encoder;
+
+
+/*
+ * Reset a parser to its initial state.
+ */
+void midi_stream_parser_init(midi_stream_parser *parser);
+
+
+/*
+ * Feed one byte to the parser. Returns 1 and fills in ev when the byte
+ * completed a message, otherwise 0. SysEx events point into the parser and
+ * are only valid until the next call.
+ */
+int midi_stream_parse(midi_stream_parser *parser,
+                      unsigned char byte,
+                      snd_seq_event_t *ev);
+
+
+/*
+ * Reset an encoder to its initial state.
+ */
+void midi_stream_encoder_init(midi_stream_encoder *encoder);
+
+
+/*
+ * Encode an event into buf, leaving out the status byte when running status
+ * allows it. Returns the number of bytes written, or 0 if the event has no
+ * MIDI byte representation or does not fit in size bytes.
+ */
+size_t midi_stream_encode(midi_stream_encoder *encoder,
+                          const snd_seq_event_t *ev,
+                          unsigned char *buf,
+                          size_t size);
+
+#endif /* _MIDI_STREAM_H_ */
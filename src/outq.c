@@ -0,0 +1,415 @@
+/*
+ * outq.c
+ *
+ * Copyright (C)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * About
+ * -----
+ *
+ * Author: AiO <aio at aio dot nu>
+ *
+ * Simple implementation of bounded output queues. Every lane is a ring of
+ * event copies, and the latest queued value of every controller and the
+ * latest queued note on of every note are indexed by their position, so
+ * replacing a superseded value or cancelling a note on never searches. A
+ * SysEx larger than a slot takes several slots in a row, and is written
+ * to the end before anything else.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <alsa/asoundlib.h>
+
+#include "error.h"
+#include "outq.h"
+
+/*
+ * Values that can be superseded, one per channel and controller, one per
+ * channel for pitch bend and one per channel for channel pressure.
+ */
+#define OUTQ_KEYS (16 * 128 + 16 + 16)
+
+typedef struct {
+  snd_seq_event_t ev;
+  void *data;
+  int more;
+  unsigned char sysex[OUTQ_DATA_SIZE];
+} outq_slot;
+
+typedef struct {
+  outq_slot *slots;
+  uint32_t head;
+  uint32_t tail;
+  outq_counts counts;
+} outq_ring;
+
+struct outq {
+  int size;
+  uint32_t mask;
+  outq_policy policy;
+  int pending;
+  int peak;
+  outq_lane partial;
+  outq_ring lanes[OUTQ_LANES];
+  uint32_t latest[OUTQ_KEYS];
+  uint32_t notes[16 * 128];
+};
+
+
+/*
+ * Find the lane of an event.
+ */
+static outq_lane outq_lane_of(const snd_seq_event_t *ev) {
+  switch (ev->type) {
+    case SND_SEQ_EVENT_NOTEOFF:
+    case SND_SEQ_EVENT_START:
+    case SND_SEQ_EVENT_CONTINUE:
+    case SND_SEQ_EVENT_STOP:
+    case SND_SEQ_EVENT_RESET: {
+      return OUTQ_URGENT;
+    }
+    case SND_SEQ_EVENT_NOTEON: {
+      return (0 == ev->data.note.velocity) ? OUTQ_URGENT : OUTQ_NOTES;
+    }
+    case SND_SEQ_EVENT_CONTROLLER: {
+      /*
+       * Bank select goes with the program changes, so that the receiver
+       * gets it before the program change it is for.
+       */
+      if (120 <= ev->data.control.param) {
+        return OUTQ_URGENT;
+      }
+      if ((0 == ev->data.control.param) || (32 == ev->data.control.param)) {
+        return OUTQ_NOTES;
+      }
+      return OUTQ_CONTROL;
+    }
+    case SND_SEQ_EVENT_KEYPRESS:
+    case SND_SEQ_EVENT_CHANPRESS:
+    case SND_SEQ_EVENT_PITCHBEND:
+    case SND_SEQ_EVENT_CONTROL14:
+    case SND_SEQ_EVENT_NONREGPARAM:
+    case SND_SEQ_EVENT_REGPARAM:
+    case SND_SEQ_EVENT_QFRAME:
+    case SND_SEQ_EVENT_CLOCK:
+    case SND_SEQ_EVENT_TICK:
+    case SND_SEQ_EVENT_SENSING: {
+      return OUTQ_CONTROL;
+    }
+    case SND_SEQ_EVENT_SYSEX: {
+      /*
+       * MIDI Machine Control commands, F0 7F <device> 06 ...
+       */
+      const unsigned char *p = (const unsigned char *)ev->data.ext.ptr;
+      if ((4 <= ev->data.ext.len) && (0x7f == p[1]) && (0x06 == p[3])) {
+        return OUTQ_URGENT;
+      }
+      return OUTQ_NOTES;
+    }
+    default: {
+      return OUTQ_NOTES;
+    }
+  }
+}
+
+
+/*
+ * Find the key of a value that a later one supersedes, or -1. Switches,
+ * bank select, data entry and (N)RPN selection mean something as a
+ * sequence and are never superseded.
+ */
+static int outq_key_of(const snd_seq_event_t *ev) {
+  int channel = ev->data.control.channel & 0x0f;
+  int param = ev->data.control.param & 0x7f;
+
+  switch (ev->type) {
+    case SND_SEQ_EVENT_CONTROLLER: {
+      if ((0 == param) || (6 == param) || (32 == param) || (38 == param) ||
+          ((64 <= param) && (69 >= param)) ||
+          ((96 <= param) && (101 >= param)) || (120 <= param)) {
+        return -1;
+      }
+      return channel * 128 + param;
+    }
+    case SND_SEQ_EVENT_PITCHBEND: {
+      return 16 * 128 + channel;
+    }
+    case SND_SEQ_EVENT_CHANPRESS: {
+      return 16 * 128 + 16 + channel;
+    }
+    default: {
+      return -1;
+    }
+  }
+}
+
+
+/*
+ * Find the slot at a position of a lane, if it is still queued.
+ */
+static outq_slot *outq_find(outq *q, outq_lane lane, uint32_t position) {
+  outq_ring *ring = &q->lanes[lane];
+
+  if (position - ring->head >= ring->tail - ring->head) {
+    return NULL;
+  }
+
+  return &ring->slots[position & q->mask];
+}
+
+
+/*
+ * Make room for an event in a lane by dropping the oldest event from the
+ * lane with the lowest priority that is not higher than its own, all the
+ * parts of it. Urgent events are never dropped. Returns 0 if nothing could
+ * be dropped.
+ */
+static int outq_drop(outq *q, outq_lane lane) {
+  int victim;
+
+  for (victim = OUTQ_CONTROL; (victim >= (int)lane) &&
+         (victim > OUTQ_URGENT); victim--) {
+    outq_ring *ring = &q->lanes[victim];
+    if (ring->head != ring->tail) {
+      outq_slot *slot = &ring->slots[ring->head & q->mask];
+      if (SND_SEQ_EVENT_NONE != slot->ev.type) {
+        ring->counts.dropped++;
+      }
+      while (0 != slot->more) {
+        ring->head++;
+        q->pending--;
+        slot = &ring->slots[ring->head & q->mask];
+      }
+      ring->head++;
+      q->pending--;
+      if (victim == (int)q->partial) {
+        q->partial = OUTQ_LANES;
+      }
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+
+/*
+ * Write the events queued in a lane, oldest first, until the lane is empty
+ * or the output is full, or only until the end of a SysEx that is partly
+ * written. Returns 0 when done and -1 when the output is full.
+ */
+static int outq_write_lane(outq *q,
+                           outq_lane lane,
+                           outq_write write,
+                           void *arg,
+                           int partial) {
+  outq_ring *ring = &q->lanes[lane];
+
+  while (ring->head != ring->tail) {
+    outq_slot *slot = &ring->slots[ring->head & q->mask];
+    if (SND_SEQ_EVENT_NONE != slot->ev.type) {
+      if (0 > write(&slot->ev, slot->data, arg)) {
+        return -1;
+      }
+      if (0 == slot->more) {
+        ring->counts.sent++;
+      }
+    }
+    ring->head++;
+    q->pending--;
+    q->partial = (0 != slot->more) ? lane : OUTQ_LANES;
+    if ((0 != partial) && (OUTQ_LANES == q->partial)) {
+      break;
+    }
+  }
+
+  return 0;
+}
+
+
+outq *outq_new(int size, outq_policy policy) {
+  outq *q;
+  int lane;
+
+  if (NULL == (q = calloc(1, sizeof(outq)))) {
+    error("Could not allocate an output queue%c", '.');
+  }
+
+  /*
+   * Every lane can hold the whole queue, the size is shared. The rings are
+   * a power of two so that positions can wrap.
+   */
+  q->size = size;
+  q->policy = policy;
+  q->partial = OUTQ_LANES;
+  q->mask = 1;
+  while ((int)q->mask < size) {
+    q->mask <<= 1;
+  }
+  for (lane = 0; lane < OUTQ_LANES; lane++) {
+    q->lanes[lane].slots = calloc(q->mask, sizeof(outq_slot));
+    if (NULL == q->lanes[lane].slots) {
+      error("Could not allocate an output queue of %d events.", size);
+    }
+  }
+
+  q->mask--;
+
+  return q;
+}
+
+
+int outq_push(outq *q, const snd_seq_event_t *ev, void *data) {
+  outq_lane lane = outq_lane_of(ev);
+  int key = outq_key_of(ev);
+  outq_ring *ring = &q->lanes[lane];
+  outq_slot *slot;
+  unsigned int offset = 0;
+  int parts = 1;
+
+  if (snd_seq_ev_is_variable(ev) && (OUTQ_DATA_SIZE < ev->data.ext.len)) {
+    parts = (ev->data.ext.len + OUTQ_DATA_SIZE - 1) / OUTQ_DATA_SIZE;
+  }
+  ring->counts.queued++;
+
+  /*
+   * A note turned off before its note on was written is not played at
+   * all. The note off still goes out, for whatever was played before.
+   */
+  if ((OUTQ_URGENT == lane) && ((SND_SEQ_EVENT_NOTEOFF == ev->type) ||
+                              (SND_SEQ_EVENT_NOTEON == ev->type))) {
+    int note = (ev->data.note.channel & 0x0f) * 128 +
+      (ev->data.note.note & 0x7f);
+    slot = outq_find(q, OUTQ_NOTES, q->notes[note]);
+    if ((NULL != slot) && (SND_SEQ_EVENT_NOTEON == slot->ev.type) &&
+        (slot->ev.data.note.channel == ev->data.note.channel) &&
+        (slot->ev.data.note.note == ev->data.note.note)) {
+      slot->ev.type = SND_SEQ_EVENT_NONE;
+      q->lanes[OUTQ_NOTES].counts.superseded++;
+    }
+  }
+
+  if ((OUTQ_SUPERSEDE == q->policy) && (0 <= key)) {
+    slot = outq_find(q, lane, q->latest[key]);
+    if ((NULL != slot) && (slot->ev.type == ev->type) &&
+        (key == outq_key_of(&slot->ev))) {
+      slot->ev = *ev;
+      slot->data = data;
+      ring->counts.superseded++;
+      return 1;
+    }
+  }
+
+  /*
+   * Nothing waits for room, not even an urgent event. It is dropped when
+   * the queue is full of events at least as urgent, and so is a SysEx
+   * that needs more slots than the queue has.
+   */
+  while (q->pending + parts > q->size) {
+    if ((parts > q->size) ||
+        ((OUTQ_NEWEST == q->policy) && (OUTQ_URGENT != lane)) ||
+        (0 == outq_drop(q, lane))) {
+      ring->counts.dropped++;
+      return 0;
+    }
+  }
+
+  if (0 <= key) {
+    q->latest[key] = ring->tail;
+  }
+  else if ((OUTQ_NOTES == lane) && (SND_SEQ_EVENT_NOTEON == ev->type)) {
+    q->notes[(ev->data.note.channel & 0x0f) * 128 +
+             (ev->data.note.note & 0x7f)] = ring->tail;
+  }
+
+  /*
+   * A SysEx is copied in parts of at most a slot, the latency is taken
+   * when the last part is written.
+   */
+  do {
+    slot = &ring->slots[ring->tail & q->mask];
+    slot->ev = *ev;
+    slot->data = data;
+    slot->more = 0;
+    if (snd_seq_ev_is_variable(ev)) {
+      unsigned int len = ev->data.ext.len - offset;
+      if (OUTQ_DATA_SIZE < len) {
+        len = OUTQ_DATA_SIZE;
+        slot->data = NULL;
+        slot->more = 1;
+      }
+      memcpy(slot->sysex, (const unsigned char *)ev->data.ext.ptr + offset,
+             len);
+      slot->ev.data.ext.len = len;
+      slot->ev.data.ext.ptr = slot->sysex;
+      offset += len;
+    }
+    ring->tail++;
+    q->pending++;
+  } while (0 != slot->more);
+
+  if (q->pending > q->peak) {
+    q->peak = q->pending;
+  }
+
+  return 1;
+}
+
+
+int outq_flush(outq *q, outq_lane lane, outq_write write, void *arg) {
+  /*
+   * Nothing may be written in the middle of a SysEx, so one that is partly
+   * written is finished first, whatever lane it is in.
+   */
+  if ((OUTQ_LANES != q->partial) && (lane != q->partial) &&
+      (0 > outq_write_lane(q, q->partial, write, arg, 1))) {
+    return -1;
+  }
+
+  return outq_write_lane(q, lane, write, arg, 0);
+}
+
+
+int outq_pending(const outq *q) {
+  return q->pending;
+}
+
+
+int outq_peak(const outq *q) {
+  return q->peak;
+}
+
+
+void outq_stats(const outq *q, outq_lane lane, outq_counts *counts) {
+  *counts = q->lanes[lane].counts;
+}
+
+
+void outq_delete(outq *q) {
+  int lane;
+
+  if (NULL == q) {
+    return;
+  }
+
+  for (lane = 0; lane < OUTQ_LANES; lane++) {
+    free(q->lanes[lane].slots);
+  }
+  free(q);
+}
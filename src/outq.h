@@ -0,0 +1,137 @@
+/*
+ * outq.h
+ *
+ * Copyright (C)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * About
+ * -----
+ *
+ * Author: AiO <aio at aio dot nu>
+ *
+ * Simple API for bounded output queues. Events that can not be written
+ * right away wait in one of three priority lanes, and are written urgent
+ * lane first when the output has room again. Nothing ever waits for the
+ * output. When a queue is full the policy decides what is dropped, never
+ * anything from a lane with higher priority than the incoming event, and
+ * every drop is counted.
+ *
+ */
+
+#ifndef _OUTQ_H_
+#define _OUTQ_H_
+
+#include <stdint.h>
+#include <alsa/asoundlib.h>
+
+/*
+ * Priority lanes, in the order they are written. Note offs, channel mode
+ * messages, transport and MIDI Machine Control are urgent, continuous data
+ * and clock come last and everything else is in between, bank select
+ * together with the program changes it is sent for.
+ */
+typedef enum {
+  OUTQ_URGENT,
+  OUTQ_NOTES,
+  OUTQ_CONTROL,
+  OUTQ_LANES
+} outq_lane;
+
+/*
+ * What to drop when a queue is full. OUTQ_SUPERSEDE replaces a queued
+ * value of the same controller, pitch bend or pressure with the new one and
+ * otherwise drops the oldest event with the lowest priority, OUTQ_OLDEST
+ * only does the latter and OUTQ_NEWEST drops the incoming event.
+ */
+typedef enum {
+  OUTQ_SUPERSEDE,
+  OUTQ_OLDEST,
+  OUTQ_NEWEST
+} outq_policy;
+
+/*
+ * Size of the slot a variable length event (SysEx) is copied to. A larger
+ * one takes several slots and is written in parts.
+ */
+#define OUTQ_DATA_SIZE 64
+
+/*
+ * Counters of a lane.
+ */
+typedef struct {
+  uint64_t queued;
+  uint64_t sent;
+  uint64_t superseded;
+  uint64_t dropped;
+} outq_counts;
+
+/*
+ * Write one queued event, with the pointer it was queued with. Return 0
+ * when it was written and a negative value when the output is full.
+ */
+typedef int (*outq_write)(snd_seq_event_t *ev, void *data, void *arg);
+
+typedef struct outq outq;
+
+
+/*
+ * Allocate a new output queue holding at most size events.
+ */
+outq *outq_new(int size, outq_policy policy);
+
+
+/*
+ * Queue a copy of an event, with a pointer that is handed back when it is
+ * written. Returns 1 if it was queued and 0 if it was dropped, since the
+ * policy dropped it, the queue is full of events at least as urgent or it
+ * needs more room than the whole queue has.
+ */
+int outq_push(outq *q, const snd_seq_event_t *ev, void *data);
+
+
+/*
+ * Write the events queued in a lane, oldest first, until the lane is empty
+ * or the output is full. A SysEx that is partly written is finished first,
+ * whatever lane it is in. Returns 0 when the lane is empty and -1 when the
+ * output is full.
+ */
+int outq_flush(outq *q, outq_lane lane, outq_write write, void *arg);
+
+
+/*
+ * Get the number of queued events.
+ */
+int outq_pending(const outq *q);
+
+
+/*
+ * Get the largest number of events that have been queued at once.
+ */
+int outq_peak(const outq *q);
+
+
+/*
+ * Get the counters of a lane.
+ */
+void outq_stats(const outq *q, outq_lane lane, outq_counts *counts);
+
+
+/*
+ * Cleanup an output queue.
+ */
+void outq_delete(outq *q);
+
+#endif /* _OUTQ_H_ */
@@ -0,0 +1,211 @@
+/*
+ * outq_test.c
+ *
+ * Copyright (C)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * About
+ * -----
+ *
+ * Author: AiO <aio at aio dot nu>
+ *
+ * Test of the order the output queue writes a patch change in. Bank
+ * select and program change must reach the receiver in the order they
+ * were queued, whatever else is queued with them. Also tests that a long
+ * SysEx is written in one piece and that nothing waits for room.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <alsa/asoundlib.h>
+
+#include "outq.h"
+
+/*
+ * Events written by the test output, in the order they were written.
+ */
+static snd_seq_event_t written[16];
+static int nwritten = 0;
+
+/*
+ * Number of events the test output has room for.
+ */
+static int room = 16;
+
+/*
+ * SysEx bytes written by the test output.
+ */
+static unsigned char sysex[256];
+static unsigned int nsysex = 0;
+
+
+static int outq_test_write(snd_seq_event_t *ev, void *data, void *arg) {
+  if (0 == room) {
+    return -1;
+  }
+  room--;
+  if (SND_SEQ_EVENT_SYSEX == ev->type) {
+    memcpy(&sysex[nsysex], ev->data.ext.ptr, ev->data.ext.len);
+    nsysex += ev->data.ext.len;
+  }
+  written[nwritten++] = *ev;
+
+  return 0;
+}
+
+
+static void outq_test_push(outq *q, int type, int param, int value) {
+  snd_seq_event_t ev;
+
+  snd_seq_ev_clear(&ev);
+  ev.type = type;
+  ev.data.control.channel = 0;
+  ev.data.control.param = param;
+  ev.data.control.value = value;
+  outq_push(q, &ev, NULL);
+}
+
+
+/*
+ * Find where an event was written, or -1.
+ */
+static int outq_test_position(int type, unsigned int param) {
+  int i;
+
+  for (i = 0; i < nwritten; i++) {
+    if ((type == written[i].type) &&
+        ((SND_SEQ_EVENT_PGMCHANGE == type) ||
+         (param == written[i].data.control.param))) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+
+/*
+ * Write everything queued, the way midi2midi does.
+ */
+static void outq_test_flush(outq *q) {
+  int lane;
+
+  for (lane = 0; lane < OUTQ_LANES; lane++) {
+    if (0 > outq_flush(q, lane, outq_test_write, NULL)) {
+      break;
+    }
+  }
+}
+
+
+/*
+ * A SysEx of 200 bytes is queued in parts, and the output gets full after
+ * two of them. A note off queued then must not end up in the middle.
+ */
+static int outq_test_sysex() {
+  outq *q = outq_new(16, OUTQ_SUPERSEDE);
+  unsigned char data[200];
+  snd_seq_event_t ev;
+  unsigned int i;
+  int result = EXIT_SUCCESS;
+
+  for (i = 0; i < sizeof(data); i++) {
+    data[i] = i & 0x7f;
+  }
+  data[0] = 0xf0;
+  data[sizeof(data) - 1] = 0xf7;
+
+  nwritten = 0;
+  snd_seq_ev_clear(&ev);
+  snd_seq_ev_set_sysex(&ev, sizeof(data), data);
+  outq_push(q, &ev, NULL);
+
+  room = 2;
+  outq_test_flush(q);
+
+  snd_seq_ev_clear(&ev);
+  snd_seq_ev_set_noteoff(&ev, 0, 60, 0);
+  outq_push(q, &ev, NULL);
+
+  room = 16;
+  outq_test_flush(q);
+  outq_delete(q);
+
+  if ((5 != nwritten) || (SND_SEQ_EVENT_NOTEOFF != written[4].type) ||
+      (sizeof(data) != nsysex) || (0 != memcmp(data, sysex, nsysex))) {
+    printf("FAIL: %d events and %u of %u SysEx bytes written, the last "
+           "event is of type %d\n", nwritten, nsysex,
+           (unsigned int)sizeof(data), written[nwritten - 1].type);
+    result = EXIT_FAILURE;
+  }
+  else {
+    printf("PASS: a long SysEx is written in one piece\n");
+  }
+
+  /*
+   * A queue full of urgent events drops the next one.
+   */
+  q = outq_new(2, OUTQ_SUPERSEDE);
+  for (i = 0; i < 2; i++) {
+    snd_seq_ev_set_noteoff(&ev, 0, 60 + i, 0);
+    outq_push(q, &ev, NULL);
+  }
+  snd_seq_ev_set_noteoff(&ev, 0, 62, 0);
+  if (0 != outq_push(q, &ev, NULL)) {
+    printf("FAIL: an urgent event did not fit and was not dropped\n");
+    result = EXIT_FAILURE;
+  }
+  else {
+    printf("PASS: nothing waits for room\n");
+  }
+  outq_delete(q);
+
+  return result;
+}
+
+
+int main() {
+  outq *q = outq_new(16, OUTQ_SUPERSEDE);
+  int msb, lsb, program;
+
+  /*
+   * Volume, then a patch change, then pan, all in one wake-up.
+   */
+  outq_test_push(q, SND_SEQ_EVENT_CONTROLLER, 7, 100);
+  outq_test_push(q, SND_SEQ_EVENT_CONTROLLER, 0, 1);
+  outq_test_push(q, SND_SEQ_EVENT_CONTROLLER, 32, 2);
+  outq_test_push(q, SND_SEQ_EVENT_PGMCHANGE, 0, 3);
+  outq_test_push(q, SND_SEQ_EVENT_CONTROLLER, 10, 64);
+
+  outq_test_flush(q);
+  outq_delete(q);
+
+  msb = outq_test_position(SND_SEQ_EVENT_CONTROLLER, 0);
+  lsb = outq_test_position(SND_SEQ_EVENT_CONTROLLER, 32);
+  program = outq_test_position(SND_SEQ_EVENT_PGMCHANGE, 0);
+
+  if ((5 != nwritten) || (0 > msb) || (msb > lsb) || (lsb > program)) {
+    printf("FAIL: bank select MSB at %d, LSB at %d and program change at %d "
+           "of %d\n", msb, lsb, program, nwritten);
+    return EXIT_FAILURE;
+  }
+
+  printf("PASS: bank select is written before its program change\n");
+
+  return outq_test_sysex();
+}
@@ -0,0 +1,389 @@
+/*
+ * pipeline.c
+ *
+ * Copyright (C)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * About
+ * -----
+ *
+ * Author: AiO <aio at aio dot nu>
+ *
+ * This is a simplified implementation of a multi-threaded translation
+ * pipeline. Every worker has one ring from the input thread and one ring to
+ * the output thread, so every ring has exactly one producer and one
+ * consumer. Threads sleep on an eventfd when their rings are empty and are
+ * woken up once per batch, not once per event.
+ *
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <alsa/asoundlib.h>
+
+#include "debug.h"
+#include "error.h"
+#include "ring.h"
+#include "rcu.h"
+#include "pipeline.h"
+
+/*
+ * Maximum number of worker threads.
+ */
+#define PIPELINE_MAX_WORKERS 16
+
+/*
+ * Number of events each ring can hold.
+ */
+#define PIPELINE_RING_SLOTS 1024
+
+/*
+ * Largest variable length event (SysEx) that fits in a slot, larger ones
+ * are passed on in parts.
+ */
+#define PIPELINE_SYSEX_SIZE 512
+
+typedef struct {
+  snd_seq_event_t ev;
+  unsigned char data[PIPELINE_SYSEX_SIZE];
+} pipeline_slot;
+
+typedef struct {
+  pipeline *p;
+  ring *in;
+  ring *out;
+  int wakeup_fd;
+  int pushed;
+  pthread_t thread;
+} pipeline_worker;
+
+struct pipeline {
+  int nworkers;
+  pipeline_shard shard;
+  pipeline_translate translate;
+  pipeline_output output;
+  pipeline_flush flush;
+  void *arg;
+  rcu *rcu;
+  int stop_workers;
+  int stop_output;
+  int output_fd;
+  pthread_t output_thread;
+  pipeline_worker workers[PIPELINE_MAX_WORKERS];
+};
+
+
+/*
+ * Wake up a thread sleeping in pipeline_sleep().
+ */
+static void pipeline_wakeup(int fd) {
+  uint64_t one = 1;
+
+  if (write(fd, &one, sizeof(one)) < 0) {
+    return;
+  }
+}
+
+
+/*
+ * Sleep until pipeline_wakeup() has been called at least once since the
+ * last time.
+ */
+static void pipeline_sleep(int fd) {
+  uint64_t count;
+
+  if (read(fd, &count, sizeof(count)) < 0) {
+    return;
+  }
+}
+
+
+/*
+ * Copy an event, including its variable length data, into a slot.
+ */
+static void pipeline_copy(pipeline_slot *slot, const snd_seq_event_t *ev) {
+  slot->ev = *ev;
+  if (snd_seq_ev_is_variable(ev)) {
+    memcpy(slot->data, ev->data.ext.ptr, ev->data.ext.len);
+    slot->ev.data.ext.ptr = slot->data;
+  }
+}
+
+
+/*
+ * Worker thread: translate everything from the input ring and pass what is
+ * to be sent on to the output thread.
+ */
+static void *pipeline_worker_run(void *arg) {
+  pipeline_worker *w = (pipeline_worker *)arg;
+  pipeline *p = w->p;
+  int reader = (NULL != p->rcu) ? rcu_register(p->rcu) : -1;
+
+  while (1) {
+    int stop = __atomic_load_n(&p->stop_workers, __ATOMIC_ACQUIRE);
+    pipeline_slot *slot;
+    int moved = 0;
+
+    if (0 <= reader) {
+      rcu_online(p->rcu, reader);
+    }
+
+    while (NULL != (slot = ring_peek(w->in))) {
+      if (p->translate(&slot->ev, p->arg)) {
+        pipeline_slot *out;
+        while (NULL == (out = ring_reserve(w->out))) {
+          pipeline_wakeup(p->output_fd);
+          sched_yield();
+        }
+        pipeline_copy(out, &slot->ev);
+        ring_commit(w->out);
+        moved = 1;
+      }
+      ring_release(w->in);
+    }
+
+    if (0 <= reader) {
+      rcu_offline(p->rcu, reader);
+    }
+
+    if (moved) {
+      pipeline_wakeup(p->output_fd);
+    }
+
+    /*
+     * The stop flag was read before draining, so nothing pushed before it
+     * was set is left behind.
+     */
+    if (stop) {
+      break;
+    }
+
+    pipeline_sleep(w->wakeup_fd);
+  }
+
+  return NULL;
+}
+
+
+/*
+ * Output thread: write everything the workers produced.
+ */
+static void *pipeline_output_run(void *arg) {
+  pipeline *p = (pipeline *)arg;
+
+  while (1) {
+    int stop = __atomic_load_n(&p->stop_output, __ATOMIC_ACQUIRE);
+    int written = 0;
+    int i;
+
+    for (i = 0; i < p->nworkers; i++) {
+      pipeline_slot *slot;
+      while (NULL != (slot = ring_peek(p->workers[i].out))) {
+        p->output(&slot->ev, p->arg);
+        ring_release(p->workers[i].out);
+        written = 1;
+      }
+    }
+
+    if (written) {
+      p->flush(p->arg);
+    }
+
+    /*
+     * The stop flag was read before draining, so everything the (already
+     * stopped) workers produced has been written.
+     */
+    if (stop) {
+      break;
+    }
+
+    pipeline_sleep(p->output_fd);
+  }
+
+  return NULL;
+}
+
+
+/*
+ * Allocate a new pipeline and start its threads.
+ */
+pipeline *pipeline_new(int workers,
+                       pipeline_shard shard,
+                       pipeline_translate translate,
+                       pipeline_output output,
+                       pipeline_flush flush,
+                       void *arg,
+                       rcu *r) {
+  pipeline *p;
+  int i;
+
+  if ((1 > workers) || (PIPELINE_MAX_WORKERS < workers)) {
+    error("The number of worker threads must be between 1 and %d.",
+          PIPELINE_MAX_WORKERS);
+  }
+
+  if (NULL == (p = calloc(1, sizeof(pipeline)))) {
+    error("Could not allocate a pipeline of %d workers.", workers);
+  }
+
+  p->nworkers = workers;
+  p->shard = shard;
+  p->translate = translate;
+  p->output = output;
+  p->flush = flush;
+  p->arg = arg;
+  p->rcu = r;
+
+  if ((p->output_fd = eventfd(0, EFD_CLOEXEC)) < 0) {
+    error("Could not create a pipeline eventfd (errno %d).", errno);
+  }
+
+  for (i = 0; i < workers; i++) {
+    pipeline_worker *w = &p->workers[i];
+    w->p = p;
+    w->in = ring_new(sizeof(pipeline_slot), PIPELINE_RING_SLOTS);
+    w->out = ring_new(sizeof(pipeline_slot), PIPELINE_RING_SLOTS);
+    if ((w->wakeup_fd = eventfd(0, EFD_CLOEXEC)) < 0) {
+      error("Could not create a pipeline eventfd (errno %d).", errno);
+    }
+    if (0 != pthread_create(&w->thread, NULL, pipeline_worker_run, w)) {
+      error("Could not start pipeline worker %d.", i);
+    }
+  }
+
+  if (0 != pthread_create(&p->output_thread, NULL, pipeline_output_run, p)) {
+    error("Could not start the pipeline output thread%c", '.');
+  }
+
+  debug("Started a pipeline with %d workers", workers);
+
+  return p;
+}
+
+
+/*
+ * Input thread: copy an event into the input ring of a worker.
+ */
+static void pipeline_worker_push(pipeline_worker *w,
+                                 const snd_seq_event_t *ev) {
+  pipeline_slot *slot;
+
+  /*
+   * Never drop anything, wait for the worker to catch up instead.
+   */
+  while (NULL == (slot = ring_reserve(w->in))) {
+    pipeline_wakeup(w->wakeup_fd);
+    sched_yield();
+  }
+  pipeline_copy(slot, ev);
+  ring_commit(w->in);
+  w->pushed = 1;
+}
+
+
+/*
+ * Input thread: hand an event to its worker.
+ */
+void pipeline_push(pipeline *p, const snd_seq_event_t *ev) {
+  pipeline_worker *w;
+  unsigned int key = ev->dest.port;
+  snd_seq_event_t part;
+  const unsigned char *data;
+  unsigned int left;
+
+  /*
+   * The translation state belongs to the input port the event was sent
+   * to, so all its events go to one worker whatever their source. By
+   * channel, the channel messages of every channel of a port get a worker
+   * of their own, the state only keeps them apart by channel.
+   */
+  if ((SHARD_BY_CHANNEL == p->shard) &&
+      (SND_SEQ_EVENT_NOTE <= ev->type) &&
+      (SND_SEQ_EVENT_REGPARAM >= ev->type)) {
+    key = key * 16 + ev->data.note.channel;
+  }
+  w = &p->workers[key % p->nworkers];
+
+  if (!snd_seq_ev_is_variable(ev) ||
+      (ev->data.ext.len <= PIPELINE_SYSEX_SIZE)) {
+    pipeline_worker_push(w, ev);
+    return;
+  }
+
+  /*
+   * A SysEx message larger than a slot is passed on in parts, one after
+   * the other through the same worker, so the receiver gets the same bytes.
+   */
+  part = *ev;
+  data = (const unsigned char *)ev->data.ext.ptr;
+  left = ev->data.ext.len;
+  while (0 < left) {
+    part.data.ext.ptr = (void *)data;
+    part.data.ext.len = (left > PIPELINE_SYSEX_SIZE) ?
+      PIPELINE_SYSEX_SIZE : left;
+    pipeline_worker_push(w, &part);
+    data += part.data.ext.len;
+    left -= part.data.ext.len;
+  }
+}
+
+
+/*
+ * Input thread: wake up the workers that got events since the last kick.
+ */
+void pipeline_kick(pipeline *p) {
+  int i;
+
+  for (i = 0; i < p->nworkers; i++) {
+    if (p->workers[i].pushed) {
+      p->workers[i].pushed = 0;
+      pipeline_wakeup(p->workers[i].wakeup_fd);
+    }
+  }
+}
+
+
+/*
+ * Stop all threads and clean up.
+ */
+void pipeline_delete(pipeline *p) {
+  int i;
+
+  __atomic_store_n(&p->stop_workers, 1, __ATOMIC_RELEASE);
+  for (i = 0; i < p->nworkers; i++) {
+    pipeline_wakeup(p->workers[i].wakeup_fd);
+    pthread_join(p->workers[i].thread, NULL);
+  }
+
+  __atomic_store_n(&p->stop_output, 1, __ATOMIC_RELEASE);
+  pipeline_wakeup(p->output_fd);
+  pthread_join(p->output_thread, NULL);
+
+  for (i = 0; i < p->nworkers; i++) {
+    ring_delete(p->workers[i].in);
+    ring_delete(p->workers[i].out);
+    close(p->workers[i].wakeup_fd);
+  }
+  close(p->output_fd);
+  free(p);
+}
@@ -0,0 +1,102 @@
+/*
+ * pipeline.h
+ *
+ * Copyright (C)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * About
+ * -----
+ *
+ * Author: AiO <aio at aio dot nu>
+ *
+ * This is a simplified API for a multi-threaded translation pipeline. The
+ * input thread shards events over a number of worker threads, which
+ * translate them and hand them to a single output thread. All stages are
+ * connected by lock-free single-producer/single-consumer rings.
+ *
+ */
+
+#ifndef _PIPELINE_H_
+#define _PIPELINE_H_
+
+#include <alsa/asoundlib.h>
+#include "rcu.h"
+
+/*
+ * Type definition for how events are spread over the workers. Events sent
+ * to the same input port always go to the same worker, so their order is
+ * kept and only one worker uses the translation state of the port. By
+ * channel, the channel messages of each channel of a port go to the same
+ * worker, so they only keep their order within the channel, and the
+ * system messages of the port only among themselves.
+ */
+typedef enum {
+  SHARD_BY_PORT,
+  SHARD_BY_CHANNEL
+} pipeline_shard;
+
+/*
+ * Translation callback, run on a worker thread. Returns 1 if the (possibly
+ * modified) event should be handed to the output thread.
+ */
+typedef int (*pipeline_translate)(snd_seq_event_t *ev, void *arg);
+
+/*
+ * Output callback, run on the output thread for each translated event.
+ */
+typedef void (*pipeline_output)(snd_seq_event_t *ev, void *arg);
+
+/*
+ * Flush callback, run on the output thread when all rings are drained.
+ */
+typedef void (*pipeline_flush)(void *arg);
+
+typedef struct pipeline pipeline;
+
+
+/*
+ * Allocate a new pipeline and start its worker and output threads. When
+ * r is not NULL every worker is a reader of it, online while translating
+ * and offline while sleeping.
+ */
+pipeline *pipeline_new(int workers,
+                       pipeline_shard shard,
+                       pipeline_translate translate,
+                       pipeline_output output,
+                       pipeline_flush flush,
+                       void *arg,
+                       rcu *r);
+
+
+/*
+ * Input thread: hand an event to its worker. The event, including any
+ * variable length data, is copied so it can be freed right after.
+ */
+void pipeline_push(pipeline *p, const snd_seq_event_t *ev);
+
+
+/*
+ * Input thread: wake up the workers that got events since the last kick.
+ */
+void pipeline_kick(pipeline *p);
+
+
+/*
+ * Stop all threads, after everything pushed has been output, and clean up.
+ */
+void pipeline_delete(pipeline *p);
+
+#endif /* _PIPELINE_H_ */
@@ -23,24 +23,64 @@
  *
  * Author: AiO <aio at aio dot nu>
  *
- * Small helpers to handle signaling to an application.
+ * Small helpers to handle signaling to an application. The signals are
+ * blocked and delivered through a signalfd so that they can be waited for
+ * together with all other file descriptors of the main loop.
  *
  */
 
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
 #include <signal.h>
+#include <unistd.h>
+#include <sys/signalfd.h>
 
+#include "error.h"
 #include "quit.h"
 
-void quit_init(void (*quit_callback)(int sig)) {
+int quit_init() {
+  sigset_t mask;
+  int fd;
+
   /*
    * Set signal listeners - Any way the user tries to kill this application
    * make sure it exits cleanly.
    */
-  signal(SIGINT, quit_callback);
-  signal(SIGTERM, quit_callback);
-  signal(SIGHUP, quit_callback);
-  signal(SIGTSTP, quit_callback);
-  signal(SIGCONT, quit_callback);
-  signal(SIGUSR1, quit_callback);
-  signal(SIGUSR2, quit_callback);
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGINT);
+  sigaddset(&mask, SIGTERM);
+  sigaddset(&mask, SIGHUP);
+  sigaddset(&mask, SIGTSTP);
+  sigaddset(&mask, SIGCONT);
+  sigaddset(&mask, SIGUSR1);
+  sigaddset(&mask, SIGUSR2);
+
+  /*
+   * Block the normal delivery, this is inherited by all threads created
+   * after this point so the signals only ever show up on the signalfd.
+   */
+  if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0) {
+    error("Could not block signals (errno %d).", errno);
+  }
+
+  if ((fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) < 0) {
+    error("Could not create a signalfd (errno %d).", errno);
+  }
+
+  return fd;
+}
+
+int quit_signal(int fd) {
+  struct signalfd_siginfo info;
+
+  if (read(fd, &info, sizeof(info)) != sizeof(info)) {
+    return 0;
+  }
+
+  return (int)info.ssi_signo;
+}
+
+void quit_delete(int fd) {
+  close(fd);
 }
@@ -30,6 +30,24 @@
 #ifndef _QUIT_H_
 #define _QUIT_H_
 
-void quit_init(void (*quit_callback)(int sig));
+/*
+ * Block all signals that should make the application exit and return a
+ * file descriptor that becomes readable when one of them arrives. Call this
+ * before any threads are created.
+ */
+int quit_init();
+
+
+/*
+ * Read the pending signal from the descriptor returned by quit_init().
+ * Returns the signal number or 0 if none was pending.
+ */
+int quit_signal(int fd);
+
+
+/*
+ * Cleanup the signal descriptor.
+ */
+void quit_delete(int fd);
 
 #endif /* _QUIT_H_ */
@@ -0,0 +1,92 @@
+/*
+ * rawmidi.c
+ *
+ * Copyright (C)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * About
+ * -----
+ *
+ * Author: AiO <aio at aio dot nu>
+ *
+ * This is a simplified implementation for opening ALSA rawmidi devices
+ * directly, bypassing the ALSA sequencer.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <alsa/asoundlib.h>
+
+#include "error.h"
+#include "rawmidi.h"
+
+/*
+ * Open a rawmidi input device and a rawmidi output device.
+ */
+void rawmidi_new(snd_rawmidi_t **in_ptr,
+                 snd_rawmidi_t **out_ptr,
+                 const char *in_device,
+                 const char *out_device) {
+  int err;
+
+  /*
+   * The input is non-blocking so that it can be drained completely on each
+   * wake-up, the output blocks if the device can not keep up.
+   */
+  if ((err = snd_rawmidi_open(in_ptr, NULL, in_device,
+                              SND_RAWMIDI_NONBLOCK)) < 0) {
+    error("Error opening rawmidi input '%s' (%s).", in_device,
+          snd_strerror(err));
+  }
+
+  if ((err = snd_rawmidi_open(NULL, out_ptr, out_device, 0)) < 0) {
+    error("Error opening rawmidi output '%s' (%s).", out_device,
+          snd_strerror(err));
+  }
+}
+
+
+/*
+ * Close the rawmidi devices.
+ */
+void rawmidi_delete(snd_rawmidi_t *in, snd_rawmidi_t *out) {
+  snd_rawmidi_drain(out);
+  snd_rawmidi_close(out);
+  snd_rawmidi_close(in);
+}
+
+
+/*
+ * Allocate and initiate a new poller for the rawmidi input.
+ */
+struct pollfd *rawmidi_poller_new(snd_rawmidi_t *in, int *npfd_ptr) {
+  struct pollfd *pfd;
+
+  *npfd_ptr = snd_rawmidi_poll_descriptors_count(in);
+  pfd = (struct pollfd *)malloc(*npfd_ptr * sizeof(struct pollfd));
+  snd_rawmidi_poll_descriptors(in, pfd, *npfd_ptr);
+
+  return pfd;
+}
+
+
+/*
+ * Cleanup a rawmidi poller.
+ */
+void rawmidi_poller_delete(struct pollfd *pfd) {
+  free(pfd);
+}
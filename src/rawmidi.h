@@ -0,0 +1,62 @@
+/*
+ * rawmidi.h
+ *
+ * Copyright (C)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * About
+ * -----
+ *
+ * Author: AiO <aio at aio dot nu>
+ *
+ * This is a simplified API for opening ALSA rawmidi devices directly,
+ * bypassing the ALSA sequencer.
+ *
+ */
+
+#ifndef _RAWMIDI_H_
+#define _RAWMIDI_H_
+
+#include <alsa/asoundlib.h>
+
+/*
+ * Open a rawmidi input device (non-blocking) and a rawmidi output device,
+ * for example "hw:1,0,0". They may be the same device.
+ */
+void rawmidi_new(snd_rawmidi_t **in_ptr,
+                 snd_rawmidi_t **out_ptr,
+                 const char *in_device,
+                 const char *out_device);
+
+
+/*
+ * Close the rawmidi devices.
+ */
+void rawmidi_delete(snd_rawmidi_t *in, snd_rawmidi_t *out);
+
+
+/*
+ * Allocate and initiate a new poller for the rawmidi input.
+ */
+struct pollfd *rawmidi_poller_new(snd_rawmidi_t *in, int *npfd_ptr);
+
+
+/*
+ * Cleanup a rawmidi poller.
+ */
+void rawmidi_poller_delete(struct pollfd *pfd);
+
+#endif /* _RAWMIDI_H_ */
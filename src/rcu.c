@@ -0,0 +1,128 @@
+/*
+ * rcu.c
+ *
+ * Copyright (C)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * About
+ * -----
+ *
+ * Author: AiO <aio at aio dot nu>
+ *
+ * Simple implementation of quiescent state based read-copy-update. There
+ * is one global epoch, and every reader has its own cache line where it
+ * stores the last epoch it has seen in a quiescent state. Offline readers
+ * store the largest possible epoch, so that they are never waited for.
+ *
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "error.h"
+#include "rcu.h"
+
+/*
+ * Maximum number of readers, enough for the main loop, all pipeline
+ * workers and the Jack process thread.
+ */
+#define RCU_MAX_READERS 32
+
+#define RCU_OFFLINE UINT64_MAX
+
+/*
+ * Every reader on its own cache line, so that readers do not slow each
+ * other down.
+ */
+typedef struct {
+  uint64_t seen;
+  char pad[64 - sizeof(uint64_t)];
+} rcu_reader;
+
+struct rcu {
+  uint64_t epoch;
+  int nreaders;
+  char pad[64 - sizeof(uint64_t) - sizeof(int)];
+  rcu_reader readers[RCU_MAX_READERS];
+};
+
+
+rcu *rcu_new() {
+  rcu *r;
+  int i;
+
+  if (NULL == (r = calloc(1, sizeof(rcu)))) {
+    error("Could not allocate a read-copy-update domain%c", '.');
+  }
+
+  r->epoch = 1;
+  for (i = 0; i < RCU_MAX_READERS; i++) {
+    r->readers[i].seen = RCU_OFFLINE;
+  }
+
+  return r;
+}
+
+int rcu_register(rcu *r) {
+  int reader = __atomic_fetch_add(&r->nreaders, 1, __ATOMIC_SEQ_CST);
+
+  if (RCU_MAX_READERS <= reader) {
+    error("At most %d read-copy-update readers are supported.",
+          RCU_MAX_READERS);
+  }
+
+  return reader;
+}
+
+void rcu_online(rcu *r, int reader) {
+  /*
+   * The sequentially consistent store makes sure no shared pointer is read
+   * before the writer can see that this reader is online.
+   */
+  __atomic_store_n(&r->readers[reader].seen,
+                   __atomic_load_n(&r->epoch, __ATOMIC_SEQ_CST),
+                   __ATOMIC_SEQ_CST);
+}
+
+void rcu_offline(rcu *r, int reader) {
+  __atomic_store_n(&r->readers[reader].seen, RCU_OFFLINE, __ATOMIC_RELEASE);
+}
+
+void rcu_quiescent(rcu *r, int reader) {
+  __atomic_store_n(&r->readers[reader].seen,
+                   __atomic_load_n(&r->epoch, __ATOMIC_SEQ_CST),
+                   __ATOMIC_SEQ_CST);
+}
+
+void rcu_synchronize(rcu *r) {
+  uint64_t target = __atomic_add_fetch(&r->epoch, 1, __ATOMIC_SEQ_CST);
+  int nreaders = __atomic_load_n(&r->nreaders, __ATOMIC_SEQ_CST);
+  int i;
+
+  for (i = 0; i < nreaders; i++) {
+    while (__atomic_load_n(&r->readers[i].seen, __ATOMIC_ACQUIRE) < target) {
+      struct timespec ts = { 0, 1000000 };
+      nanosleep(&ts, NULL);
+    }
+  }
+}
+
+void rcu_delete(rcu *r) {
+  free(r);
+}
@@ -0,0 +1,82 @@
+/*
+ * rcu.h
+ *
+ * Copyright (C)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * About
+ * -----
+ *
+ * Author: AiO <aio at aio dot nu>
+ *
+ * Simple API for quiescent state based read-copy-update. Readers load
+ * shared pointers with __atomic_load_n() while online and never block on
+ * the writer. The writer publishes new data with an atomic pointer store
+ * and calls rcu_synchronize() before freeing the old data. A reader must
+ * go offline whenever it may sleep for long, for example in poll(), and
+ * can announce a quiescent state whenever it holds no shared pointers.
+ *
+ */
+
+#ifndef _RCU_H_
+#define _RCU_H_
+
+typedef struct rcu rcu;
+
+
+/*
+ * Allocate a new read-copy-update domain.
+ */
+rcu *rcu_new();
+
+
+/*
+ * Register a reader and return its number. It starts out offline.
+ */
+int rcu_register(rcu *r);
+
+
+/*
+ * Reader: start using shared pointers.
+ */
+void rcu_online(rcu *r, int reader);
+
+
+/*
+ * Reader: stop using shared pointers until rcu_online() is called again.
+ */
+void rcu_offline(rcu *r, int reader);
+
+
+/*
+ * Reader: no shared pointers are held at this point.
+ */
+void rcu_quiescent(rcu *r, int reader);
+
+
+/*
+ * Writer: wait until no reader can hold a pointer that was replaced before
+ * the call.
+ */
+void rcu_synchronize(rcu *r);
+
+
+/*
+ * Cleanup the domain.
+ */
+void rcu_delete(rcu *r);
+
+#endif /* _RCU_H_ */
@@ -0,0 +1,185 @@
+/*
+ * realtime.c
+ *
+ * Copyright (C)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * About
+ * -----
+ *
+ * Author: AiO <aio at aio dot nu>
+ *
+ * Simple implementation for running the calling thread with realtime
+ * scheduling and locked memory.
+ *
+ */
+
+/*
+ * Needed for sched_setaffinity() and RUSAGE_THREAD.
+ */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <malloc.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#include "debug.h"
+#include "error.h"
+#include "realtime.h"
+
+/*
+ * Amount of stack to fault in and lock up front. This is way more than the
+ * event path ever uses.
+ */
+#define REALTIME_STACK_PREFAULT (256 * 1024)
+
+
+/*
+ * Touch every page of a large stack frame so that the stack pages the
+ * event path will use are mapped (and locked) before they are needed.
+ */
+static void realtime_prefault_stack() {
+  volatile unsigned char stack[REALTIME_STACK_PREFAULT];
+  long page_size = sysconf(_SC_PAGESIZE);
+  size_t i;
+
+  for (i = 0; i < sizeof(stack); i += page_size) {
+    stack[i] = 0;
+  }
+}
+
+
+/*
+ * Try SCHED_FIFO with the requested priority and, if the rtprio limit is
+ * lower, with the highest priority the limit allows.
+ */
+static int realtime_set_priority(int priority) {
+  struct sched_param param;
+  struct rlimit limit;
+  int max = sched_get_priority_max(SCHED_FIFO);
+
+  if (priority > max) {
+    priority = max;
+  }
+
+  memset(&param, 0, sizeof(param));
+  param.sched_priority = priority;
+
+  if (0 == sched_setscheduler(0, SCHED_FIFO, &param)) {
+    debug("Running with SCHED_FIFO priority %d", priority);
+    return 1;
+  }
+
+  if ((EPERM == errno) &&
+      (0 == getrlimit(RLIMIT_RTPRIO, &limit)) &&
+      (limit.rlim_cur > 0) && (limit.rlim_cur < (rlim_t)priority)) {
+    param.sched_priority = (int)limit.rlim_cur;
+    if (0 == sched_setscheduler(0, SCHED_FIFO, &param)) {
+      warning("SCHED_FIFO priority %d refused, the rtprio limit allows %d.",
+              priority, param.sched_priority);
+      return 1;
+    }
+  }
+
+  warning("Could not set SCHED_FIFO priority %d (%s), using normal "
+          "scheduling.", priority, strerror(errno));
+
+  return 0;
+}
+
+
+/*
+ * Lock all current and future memory and make sure the heap is never given
+ * back to the system, since that would fault it in again later.
+ */
+static int realtime_lock_memory() {
+  mallopt(M_TRIM_THRESHOLD, -1);
+  mallopt(M_MMAP_MAX, 0);
+
+  if (0 != mlockall(MCL_CURRENT | MCL_FUTURE)) {
+    warning("Could not lock memory (%s), it may be paged out.",
+            strerror(errno));
+    realtime_prefault_stack();
+    return 0;
+  }
+
+  realtime_prefault_stack();
+  debug("Locked and prefaulted memory (%d bytes of stack)",
+        REALTIME_STACK_PREFAULT);
+
+  return 1;
+}
+
+
+/*
+ * Pin the calling thread to one CPU.
+ */
+static int realtime_pin_cpu(int cpu) {
+  cpu_set_t set;
+
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+
+  if (0 != sched_setaffinity(0, sizeof(set), &set)) {
+    warning("Could not pin the event thread to CPU %d (%s).",
+            cpu, strerror(errno));
+    return 0;
+  }
+
+  debug("Pinned the event thread to CPU %d", cpu);
+
+  return 1;
+}
+
+
+/*
+ * Switch the calling thread to realtime operation.
+ */
+realtime_status realtime_init(int priority, int cpu) {
+  realtime_status status = RT_NONE;
+
+  if (realtime_lock_memory()) {
+    status |= RT_MEMORY_LOCKED;
+  }
+
+  if ((cpu >= 0) && realtime_pin_cpu(cpu)) {
+    status |= RT_CPU_PINNED;
+  }
+
+  if (realtime_set_priority(priority)) {
+    status |= RT_SCHED_FIFO;
+  }
+
+  return status;
+}
+
+
+/*
+ * Get the number of page faults the calling thread has caused so far.
+ */
+long realtime_page_faults() {
+  struct rusage usage;
+
+  if (0 != getrusage(RUSAGE_THREAD, &usage)) {
+    return 0;
+  }
+
+  return usage.ru_minflt + usage.ru_majflt;
+}
@@ -0,0 +1,64 @@
+/*
+ * realtime.h
+ *
+ * Copyright (C)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * About
+ * -----
+ *
+ * Author: AiO <aio at aio dot nu>
+ *
+ * Simple API for running the calling thread with realtime scheduling and
+ * locked memory.
+ *
+ */
+
+#ifndef _REALTIME_H_
+#define _REALTIME_H_
+
+/*
+ * Default SCHED_FIFO priority used by the realtime mode.
+ */
+#define REALTIME_DEFAULT_PRIORITY 40
+
+/*
+ * Type definition for the parts of the realtime mode that actually got
+ * applied.
+ */
+typedef enum {
+  RT_NONE = 0,
+  RT_SCHED_FIFO = 1,
+  RT_MEMORY_LOCKED = 2,
+  RT_CPU_PINNED = 4
+} realtime_status;
+
+
+/*
+ * Switch the calling thread to SCHED_FIFO with the given priority, lock and
+ * prefault all memory and pin the thread to cpu (or not at all if cpu is
+ * negative). Each step that is refused is reported as a warning and skipped,
+ * the returned mask tells what was applied.
+ */
+realtime_status realtime_init(int priority, int cpu);
+
+
+/*
+ * Get the number of page faults the calling thread has caused so far.
+ */
+long realtime_page_faults();
+
+#endif /* _REALTIME_H_ */
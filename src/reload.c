@@ -0,0 +1,106 @@
+/*
+ * reload.c
+ *
+ * Copyright (C)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * About
+ * -----
+ *
+ * Author: AiO <aio at aio dot nu>
+ *
+ * Simple implementation of a reload thread sleeping on an eventfd.
+ *
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#include "error.h"
+#include "debug.h"
+#include "reload.h"
+
+struct reload {
+  reload_callback callback;
+  void *arg;
+  int fd;
+  int stop;
+  pthread_t thread;
+};
+
+
+static void *reload_run(void *arg) {
+  reload *r = (reload *)arg;
+
+  while (1) {
+    uint64_t count;
+
+    if (read(r->fd, &count, sizeof(count)) < 0) {
+      continue;
+    }
+    if (__atomic_load_n(&r->stop, __ATOMIC_ACQUIRE)) {
+      break;
+    }
+
+    debug("Reloading after %lu requests", (unsigned long)count);
+    r->callback(r->arg);
+  }
+
+  return NULL;
+}
+
+reload *reload_new(reload_callback callback, void *arg) {
+  reload *r;
+
+  if (NULL == (r = calloc(1, sizeof(reload)))) {
+    error("Could not allocate the reload thread%c", '.');
+  }
+
+  r->callback = callback;
+  r->arg = arg;
+
+  if ((r->fd = eventfd(0, EFD_CLOEXEC)) < 0) {
+    error("Could not create a reload eventfd (errno %d).", errno);
+  }
+
+  if (0 != pthread_create(&r->thread, NULL, reload_run, r)) {
+    error("Could not start the reload thread%c", '.');
+  }
+
+  return r;
+}
+
+void reload_request(reload *r) {
+  uint64_t one = 1;
+
+  if (write(r->fd, &one, sizeof(one)) < 0) {
+    return;
+  }
+}
+
+void reload_delete(reload *r) {
+  __atomic_store_n(&r->stop, 1, __ATOMIC_RELEASE);
+  reload_request(r);
+  pthread_join(r->thread, NULL);
+  close(r->fd);
+  free(r);
+}
@@ -0,0 +1,60 @@
+/*
+ * reload.h
+ *
+ * Copyright (C)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * About
+ * -----
+ *
+ * Author: AiO <aio at aio dot nu>
+ *
+ * Simple API for a background thread that reloads the configuration on
+ * request, so that the event loop never waits for file reading or memory
+ * allocation.
+ *
+ */
+
+#ifndef _RELOAD_H_
+#define _RELOAD_H_
+
+typedef struct reload reload;
+
+/*
+ * Called on the reload thread once per request, several requests made
+ * while it runs are handled by one call.
+ */
+typedef void (*reload_callback)(void *arg);
+
+
+/*
+ * Start a reload thread.
+ */
+reload *reload_new(reload_callback callback, void *arg);
+
+
+/*
+ * Ask for a reload. This never blocks and is safe to call from anywhere.
+ */
+void reload_request(reload *r);
+
+
+/*
+ * Stop the reload thread, after any reload in progress, and clean up.
+ */
+void reload_delete(reload *r);
+
+#endif /* _RELOAD_H_ */
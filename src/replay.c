@@ -0,0 +1,298 @@
+/*
+ * replay.c
+ *
+ * Copyright (C)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * About
+ * -----
+ *
+ * Author: AiO <aio at aio dot nu>
+ *
+ * Simple implementation of loading recorded MIDI sessions. Both standard
+ * MIDI files and raw dumps are turned into events by the same byte stream
+ * parser as the rawmidi backend uses.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <alsa/asoundlib.h>
+
+#include "error.h"
+#include "debug.h"
+#include "midi_stream.h"
+#include "replay.h"
+
+/*
+ * Growable storage for the events and SysEx data while loading. While
+ * loading, SysEx events hold the offset of their data in the SysEx buffer
+ * instead of a pointer, since the buffer may move when it grows.
+ */
+typedef struct {
+  replay *r;
+  size_t events_size;
+  size_t sysex_len;
+  size_t sysex_size;
+} replay_loader;
+
+
+/*
+ * Append the event the parser just completed.
+ */
+static void replay_append(replay_loader *loader, const snd_seq_event_t *ev) {
+  replay *r = loader->r;
+  snd_seq_event_t *copy;
+
+  if (r->nevents == loader->events_size) {
+    loader->events_size = (0 == loader->events_size) ?
+      4096 : loader->events_size * 2;
+    r->events = realloc(r->events,
+                        loader->events_size * sizeof(snd_seq_event_t));
+    if (NULL == r->events) {
+      error("Could not allocate memory for %lu replay events.",
+            (unsigned long)loader->events_size);
+    }
+  }
+
+  copy = &r->events[r->nevents++];
+  *copy = *ev;
+
+  if (SND_SEQ_EVENT_SYSEX == ev->type) {
+    if (loader->sysex_len + ev->data.ext.len > loader->sysex_size) {
+      loader->sysex_size = (0 == loader->sysex_size) ?
+        4096 : loader->sysex_size * 2;
+      r->sysex = realloc(r->sysex, loader->sysex_size);
+      if (NULL == r->sysex) {
+        error("Could not allocate memory for %lu bytes of replay SysEx.",
+              (unsigned long)loader->sysex_size);
+      }
+    }
+    memcpy(&r->sysex[loader->sysex_len], ev->data.ext.ptr, ev->data.ext.len);
+    copy->data.ext.ptr = (void *)(uintptr_t)loader->sysex_len;
+    loader->sysex_len += ev->data.ext.len;
+  }
+}
+
+
+/*
+ * Feed bytes to the parser and append every completed event.
+ */
+static void replay_parse(replay_loader *loader,
+                         midi_stream_parser *parser,
+                         const unsigned char *buf,
+                         size_t len) {
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    snd_seq_event_t ev;
+    if (1 == midi_stream_parse(parser, buf[i], &ev)) {
+      replay_append(loader, &ev);
+    }
+  }
+}
+
+
+/*
+ * Read a big-endian number of the given number of bytes.
+ */
+static uint32_t replay_be(const unsigned char *buf, int bytes) {
+  uint32_t value = 0;
+  int i;
+
+  for (i = 0; i < bytes; i++) {
+    value = (value << 8) | buf[i];
+  }
+
+  return value;
+}
+
+
+/*
+ * Read a variable length quantity of a standard MIDI file, moving pos past
+ * it.
+ */
+static uint32_t replay_varlen(const unsigned char *buf,
+                              size_t len,
+                              size_t *pos) {
+  uint32_t value = 0;
+  int i;
+
+  for (i = 0; (i < 4) && (*pos < len); i++) {
+    unsigned char byte = buf[(*pos)++];
+    value = (value << 7) | (byte & 0x7f);
+    if (0 == (byte & 0x80)) {
+      break;
+    }
+  }
+
+  return value;
+}
+
+
+/*
+ * Load one MTrk chunk. Channel messages are handed to the parser with the
+ * running status of the file, meta events are skipped.
+ */
+static void replay_track(replay_loader *loader,
+                         const char *filename,
+                         const unsigned char *buf,
+                         size_t len) {
+  midi_stream_parser parser;
+  size_t pos = 0;
+
+  midi_stream_parser_init(&parser);
+
+  while (pos < len) {
+    unsigned char status;
+    uint32_t length;
+
+    replay_varlen(buf, len, &pos);
+    if (pos >= len) {
+      break;
+    }
+
+    status = buf[pos];
+    if (0xff == status) {
+      pos += 2;
+      length = replay_varlen(buf, len, &pos);
+      pos += length;
+    }
+    else if ((0xf0 == status) || (0xf7 == status)) {
+      pos++;
+      length = replay_varlen(buf, len, &pos);
+      if (pos + length > len) {
+        error("Truncated SysEx in '%s'.", filename);
+      }
+      if (0xf0 == status) {
+        replay_parse(loader, &parser, &status, 1);
+      }
+      replay_parse(loader, &parser, &buf[pos], length);
+      pos += length;
+    }
+    else {
+      /*
+       * Program change and channel pressure have one data byte, all other
+       * channel messages two.
+       */
+      unsigned char running = (status & 0x80) ? status : parser.status;
+      size_t bytes = ((0xc0 == (running & 0xf0)) ||
+                      (0xd0 == (running & 0xf0))) ? 1 : 2;
+      if (status & 0x80) {
+        bytes++;
+      }
+      if (pos + bytes > len) {
+        error("Truncated event in '%s'.", filename);
+      }
+      replay_parse(loader, &parser, &buf[pos], bytes);
+      pos += bytes;
+    }
+  }
+}
+
+
+/*
+ * Load a standard MIDI file, all its MTrk chunks one after the other.
+ */
+static void replay_smf(replay_loader *loader,
+                       const char *filename,
+                       const unsigned char *buf,
+                       size_t len) {
+  size_t pos = 0;
+
+  while (pos + 8 <= len) {
+    uint32_t chunk_len = replay_be(&buf[pos + 4], 4);
+
+    if (pos + 8 + chunk_len > len) {
+      error("Truncated chunk in '%s'.", filename);
+    }
+    if (0 == memcmp(&buf[pos], "MTrk", 4)) {
+      replay_track(loader, filename, &buf[pos + 8], chunk_len);
+    }
+    else if (0 == memcmp(&buf[pos], "MThd", 4)) {
+      debug("Standard MIDI file format %d with %d tracks",
+            (int)replay_be(&buf[pos + 8], 2),
+            (int)replay_be(&buf[pos + 10], 2));
+    }
+    pos += 8 + chunk_len;
+  }
+}
+
+
+replay *replay_new(const char *filename) {
+  replay_loader loader;
+  replay *r;
+  FILE *fd;
+  unsigned char *buf;
+  long len;
+  size_t i;
+
+  if (NULL == (fd = fopen(filename, "rb"))) {
+    error("Unable to open file '%s'.", filename);
+  }
+
+  fseek(fd, 0, SEEK_END);
+  len = ftell(fd);
+  rewind(fd);
+
+  if ((0 > len) || (NULL == (buf = malloc(len + 1)))) {
+    error("Could not read file '%s'.", filename);
+  }
+  if ((size_t)len != fread(buf, 1, len, fd)) {
+    error("Could not read file '%s'.", filename);
+  }
+  fclose(fd);
+
+  if (NULL == (r = calloc(1, sizeof(replay)))) {
+    error("Could not allocate memory for replaying '%s'.", filename);
+  }
+  memset(&loader, 0, sizeof(loader));
+  loader.r = r;
+
+  if ((14 <= len) && (0 == memcmp(buf, "MThd", 4))) {
+    debug("Loading '%s' as a standard MIDI file", filename);
+    replay_smf(&loader, filename, buf, len);
+  }
+  else {
+    midi_stream_parser parser;
+    debug("Loading '%s' as a raw MIDI dump", filename);
+    midi_stream_parser_init(&parser);
+    replay_parse(&loader, &parser, buf, len);
+  }
+  free(buf);
+
+  /*
+   * All SysEx data is in place now, so the offsets can become pointers.
+   */
+  for (i = 0; i < r->nevents; i++) {
+    if (SND_SEQ_EVENT_SYSEX == r->events[i].type) {
+      r->events[i].data.ext.ptr =
+        &r->sysex[(uintptr_t)r->events[i].data.ext.ptr];
+    }
+  }
+
+  debug("Loaded %lu events from '%s'", (unsigned long)r->nevents, filename);
+
+  return r;
+}
+
+void replay_delete(replay *r) {
+  free(r->events);
+  free(r->sysex);
+  free(r);
+}
@@ -0,0 +1,58 @@
+/*
+ * replay.h
+ *
+ * Copyright (C)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * About
+ * -----
+ *
+ * Author: AiO <aio at aio dot nu>
+ *
+ * Simple API for loading a recorded MIDI session into memory as ALSA
+ * sequencer events, so that it can be replayed without any MIDI device.
+ * Standard MIDI files (format 0 and 1) are recognised by their header,
+ * anything else is taken to be a raw MIDI byte dump like the ones written
+ * by amidi -r.
+ *
+ */
+
+#ifndef _REPLAY_H_
+#define _REPLAY_H_
+
+#include <stddef.h>
+#include <alsa/asoundlib.h>
+
+typedef struct {
+  snd_seq_event_t *events;
+  size_t nevents;
+  unsigned char *sysex;
+} replay;
+
+
+/*
+ * Load all events of a file. The events of a standard MIDI file are kept
+ * track by track, timing is not kept at all.
+ */
+replay *replay_new(const char *filename);
+
+
+/*
+ * Return the events and the memory they use to the system.
+ */
+void replay_delete(replay *r);
+
+#endif /* _REPLAY_H_ */
@@ -0,0 +1,145 @@
+/*
+ * ring.c
+ *
+ * Copyright (C)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * About
+ * -----
+ *
+ * Author: AiO <aio at aio dot nu>
+ *
+ * Simple implementation of a lock-free single-producer/single-consumer ring
+ * of fixed-size slots. The producer only writes head and the consumer only
+ * writes tail, each keeps a cached copy of the other index so that the
+ * shared cache lines are only touched when the cached view runs out.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "error.h"
+#include "ring.h"
+
+/*
+ * Keep the indexes written by different threads on different cache lines.
+ */
+#define RING_CACHE_LINE 64
+
+struct ring {
+  /*
+   * Written by the producer.
+   */
+  size_t head;
+  size_t tail_cache;
+  char pad0[RING_CACHE_LINE - 2 * sizeof(size_t)];
+
+  /*
+   * Written by the consumer.
+   */
+  size_t tail;
+  size_t head_cache;
+  char pad1[RING_CACHE_LINE - 2 * sizeof(size_t)];
+
+  size_t mask;
+  size_t slot_size;
+  unsigned char *slots;
+};
+
+
+/*
+ * Allocate a new ring.
+ */
+ring *ring_new(size_t slot_size, size_t slots) {
+  ring *r;
+  size_t size = 1;
+
+  while (size < slots) {
+    size <<= 1;
+  }
+
+  if (NULL == (r = calloc(1, sizeof(ring)))) {
+    error("Could not allocate a ring of %d slots.", (int)size);
+  }
+  if (NULL == (r->slots = calloc(size, slot_size))) {
+    error("Could not allocate a ring of %d slots.", (int)size);
+  }
+
+  r->mask = size - 1;
+  r->slot_size = slot_size;
+
+  return r;
+}
+
+
+/*
+ * Producer: get the next free slot.
+ */
+void *ring_reserve(ring *r) {
+  size_t head = r->head;
+
+  if (head - r->tail_cache > r->mask) {
+    r->tail_cache = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    if (head - r->tail_cache > r->mask) {
+      return NULL;
+    }
+  }
+
+  return &r->slots[(head & r->mask) * r->slot_size];
+}
+
+
+/*
+ * Producer: publish the reserved slot.
+ */
+void ring_commit(ring *r) {
+  __atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * Consumer: get the oldest published slot.
+ */
+void *ring_peek(ring *r) {
+  size_t tail = r->tail;
+
+  if (tail == r->head_cache) {
+    r->head_cache = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    if (tail == r->head_cache) {
+      return NULL;
+    }
+  }
+
+  return &r->slots[(tail & r->mask) * r->slot_size];
+}
+
+
+/*
+ * Consumer: give the slot back to the producer.
+ */
+void ring_release(ring *r) {
+  __atomic_store_n(&r->tail, r->tail + 1, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * Cleanup a ring.
+ */
+void ring_delete(ring *r) {
+  free(r->slots);
+  free(r);
+}
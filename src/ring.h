@@ -0,0 +1,77 @@
+/*
+ * ring.h
+ *
+ * Copyright (C)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * About
+ * -----
+ *
+ * Author: AiO <aio at aio dot nu>
+ *
+ * Simple API for a lock-free single-producer/single-consumer ring of
+ * fixed-size slots. Exactly one thread may produce and exactly one thread
+ * may consume.
+ *
+ */
+
+#ifndef _RING_H_
+#define _RING_H_
+
+#include <stddef.h>
+
+typedef struct ring ring;
+
+
+/*
+ * Allocate a new ring with slots slots (rounded up to a power of two) of
+ * slot_size bytes each.
+ */
+ring *ring_new(size_t slot_size, size_t slots);
+
+
+/*
+ * Producer: get the next free slot, or NULL if the ring is full. The slot
+ * is handed over to the consumer by ring_commit().
+ */
+void *ring_reserve(ring *r);
+
+
+/*
+ * Producer: publish the slot returned by ring_reserve().
+ */
+void ring_commit(ring *r);
+
+
+/*
+ * Consumer: get the oldest published slot, or NULL if the ring is empty.
+ * The slot is handed back to the producer by ring_release().
+ */
+void *ring_peek(ring *r);
+
+
+/*
+ * Consumer: give the slot returned by ring_peek() back to the producer.
+ */
+void ring_release(ring *r);
+
+
+/*
+ * Cleanup a ring.
+ */
+void ring_delete(ring *r);
+
+#endif /* _RING_H_ */
@@ -42,20 +42,6 @@ snd_seq_t *sequencer_new(int *in_port_ptr,
 
   snd_seq_t *seq_handle;
 
-  char input_name[255];
-  char output_name[255];
-  int mode = 0;
-
-  sprintf(input_name, "%s - In", port_name);
-  sprintf(output_name, "%s - Out", port_name);
-
-  if (NULL != in_port_ptr) {
-    mode = mode | SND_SEQ_OPEN_INPUT;
-  }
-  if (NULL != out_port_ptr) {
-    mode = mode | SND_SEQ_OPEN_OUTPUT;
-  }
-
   /*
    * Open an ALSA MIDI input and output ports.
    */
@@ -64,6 +50,25 @@ snd_seq_t *sequencer_new(int *in_port_ptr,
   }
   snd_seq_set_client_name(seq_handle, port_name);
 
+  sequencer_ports_new(seq_handle, in_port_ptr, out_port_ptr, port_name);
+
+  return seq_handle;
+}
+
+
+/*
+ * Create another pair of MIDI ports on an already opened sequencer client.
+ */
+void sequencer_ports_new(snd_seq_t *seq_handle,
+                         int *in_port_ptr,
+                         int *out_port_ptr,
+                         char *port_name) {
+  char input_name[255];
+  char output_name[255];
+
+  snprintf(input_name, sizeof(input_name), "%s - In", port_name);
+  snprintf(output_name, sizeof(output_name), "%s - Out", port_name);
+
   if (in_port_ptr) {
     *in_port_ptr = snd_seq_create_simple_port(seq_handle, input_name,
                                               SND_SEQ_PORT_CAP_WRITE |
@@ -83,8 +88,50 @@ snd_seq_t *sequencer_new(int *in_port_ptr,
       error("Error creating sequencer output port for '%s'.", port_name);
     }
   }
+}
 
-  return seq_handle;
+
+/*
+ * Set the sizes of the pools and buffers of a client.
+ */
+void sequencer_buffers(snd_seq_t *seq_handle,
+                       int pool,
+                       int input_buffer,
+                       int output_buffer) {
+  if ((0 < pool) &&
+      ((snd_seq_set_client_pool_input(seq_handle, pool) < 0) ||
+       (snd_seq_set_client_pool_output(seq_handle, pool) < 0))) {
+    error("Error setting the sequencer pools to %d events.", pool);
+  }
+  if ((0 < input_buffer) &&
+      (snd_seq_set_input_buffer_size(seq_handle, input_buffer) < 0)) {
+    error("Error setting the sequencer input buffer to %d bytes.",
+          input_buffer);
+  }
+  if ((0 < output_buffer) &&
+      (snd_seq_set_output_buffer_size(seq_handle, output_buffer) < 0)) {
+    error("Error setting the sequencer output buffer to %d bytes.",
+          output_buffer);
+  }
+}
+
+
+/*
+ * Get the number of events lost on the input of a client.
+ */
+int sequencer_lost(snd_seq_t *seq_handle) {
+  snd_seq_client_info_t *info;
+  int lost = -1;
+
+  if (snd_seq_client_info_malloc(&info) < 0) {
+    return -1;
+  }
+  if (snd_seq_get_client_info(seq_handle, info) >= 0) {
+    lost = snd_seq_client_info_get_event_lost(info);
+  }
+  snd_seq_client_info_free(info);
+
+  return lost;
 }
 
 
@@ -38,6 +38,34 @@
 snd_seq_t *sequencer_new(int *in_port_ptr, int *out_port_ptr, char *port_name);
 
 
+/*
+ * Create another pair of MIDI ports on an already opened sequencer client.
+ */
+void sequencer_ports_new(snd_seq_t *seq_handle,
+                         int *in_port_ptr,
+                         int *out_port_ptr,
+                         char *port_name);
+
+
+/*
+ * Set the size of the kernel input and output pools of the client, in
+ * events, and of the input and output buffers of the library, in bytes. A
+ * size of 0 keeps the ALSA default. Larger pools and buffers let the
+ * client take bursts like SysEx dumps without losing events.
+ */
+void sequencer_buffers(snd_seq_t *seq_handle,
+                       int pool,
+                       int input_buffer,
+                       int output_buffer);
+
+
+/*
+ * Get the number of events the sequencer had to throw away because the
+ * input of the client was full, or -1 if it can not be told.
+ */
+int sequencer_lost(snd_seq_t *seq_handle);
+
+
 /*
  * Cleanup MIDI interfaces and locked resources.
  */
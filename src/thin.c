@@ -0,0 +1,259 @@
+/*
+ * thin.c
+ *
+ * Copyright (C)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * About
+ * -----
+ *
+ * Author: AiO <aio at aio dot nu>
+ *
+ * Simple implementation of thinning out continuous data. Every stream has
+ * a slot with the last value sent and the latest value held back, and the
+ * held slots are kept in a list so that flushing never looks at the rest.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <alsa/asoundlib.h>
+
+#include "error.h"
+#include "thin.h"
+
+/*
+ * Slots, one per channel and controller, one per channel for pitch bend
+ * and one per channel for channel pressure.
+ */
+#define THIN_SLOTS (16 * 128 + 16 + 16)
+
+/*
+ * A value held back only because it differs too little is sent when the
+ * stream has been quiet for this many nanoseconds.
+ */
+#define THIN_HOLD_TIME 20000000ULL
+
+typedef struct {
+  uint64_t time;
+  int last;
+  int pending;
+  unsigned char sent;
+  unsigned char held;
+} thin_slot;
+
+struct thin {
+  thin_policy policy[THIN_TYPES];
+  uint64_t interval[THIN_TYPES];
+  uint64_t received[THIN_TYPES];
+  uint64_t sent[THIN_TYPES];
+  uint64_t due;
+  int nheld;
+  unsigned short held[THIN_SLOTS];
+  thin_slot slots[THIN_SLOTS];
+};
+
+
+/*
+ * Switches, bank select, data entry and (N)RPN selection mean something
+ * as a sequence, only the controllers that are continuous are thinned.
+ */
+static int thin_continuous(int param) {
+  return !((0 == param) || (6 == param) || (32 == param) ||
+           (38 == param) || ((64 <= param) && (69 >= param)) ||
+           ((96 <= param) && (101 >= param)) || (120 <= param));
+}
+
+
+/*
+ * Find the kind of stream and the slot of an event, returns -1 for events
+ * that are not thinned.
+ */
+static int thin_slot_of(const snd_seq_event_t *ev, thin_type *type) {
+  int channel = ev->data.control.channel & 0x0f;
+
+  switch (ev->type) {
+    case SND_SEQ_EVENT_CONTROLLER: {
+      if (!thin_continuous(ev->data.control.param & 0x7f)) {
+        return -1;
+      }
+      *type = THIN_CC;
+      return channel * 128 + (ev->data.control.param & 0x7f);
+    }
+    case SND_SEQ_EVENT_PITCHBEND: {
+      *type = THIN_PITCHBEND;
+      return 16 * 128 + channel;
+    }
+    case SND_SEQ_EVENT_CHANPRESS: {
+      *type = THIN_PRESSURE;
+      return 16 * 128 + 16 + channel;
+    }
+    default: {
+      return -1;
+    }
+  }
+}
+
+
+/*
+ * When a held value of a stream is due.
+ */
+static uint64_t thin_slot_due(const thin *t,
+                              const thin_slot *slot,
+                              thin_type type) {
+  uint64_t wait = t->interval[type];
+
+  if (THIN_HOLD_TIME > wait) {
+    wait = THIN_HOLD_TIME;
+  }
+
+  return slot->time + wait;
+}
+
+
+thin *thin_new(const thin_policy policy[THIN_TYPES]) {
+  thin *t;
+  int type;
+
+  if (NULL == (t = calloc(1, sizeof(thin)))) {
+    error("Could not allocate the stream thinning state%c", '.');
+  }
+
+  for (type = 0; type < THIN_TYPES; type++) {
+    t->policy[type] = policy[type];
+    t->interval[type] = (0 < policy[type].rate) ?
+      1000000000ULL / policy[type].rate : 0;
+  }
+
+  return t;
+}
+
+
+int thin_event(thin *t, const snd_seq_event_t *ev, uint64_t now) {
+  thin_type type = THIN_CC;
+  int index = thin_slot_of(ev, &type);
+  const thin_policy *policy;
+  thin_slot *slot;
+  int value;
+
+  if (0 > index) {
+    return 1;
+  }
+  policy = &t->policy[type];
+  if ((0 == policy->rate) && (0 == policy->delta)) {
+    return 1;
+  }
+
+  slot = &t->slots[index];
+  value = ev->data.control.value;
+  t->received[type]++;
+
+  /*
+   * A value that is due and differs enough goes out right away, and makes
+   * anything held for the stream obsolete.
+   */
+  if ((0 == slot->sent) ||
+      ((value != slot->last) &&
+       (now - slot->time >= t->interval[type]) &&
+       (abs(value - slot->last) >= policy->delta))) {
+    slot->sent = 1;
+    slot->last = slot->pending = value;
+    slot->time = now;
+    t->sent[type]++;
+    return 1;
+  }
+
+  /*
+   * Otherwise only the latest value is kept, a value equal to the last one
+   * sent just cancels what was held.
+   */
+  slot->pending = value;
+  if ((value != slot->last) && (0 == slot->held)) {
+    uint64_t due = thin_slot_due(t, slot, type);
+    slot->held = 1;
+    t->held[t->nheld++] = index;
+    if ((0 == t->due) || (due < t->due)) {
+      t->due = due;
+    }
+  }
+
+  return 0;
+}
+
+
+void thin_flush(thin *t, uint64_t now, thin_output output, void *arg) {
+  int i = 0;
+
+  t->due = 0;
+
+  while (i < t->nheld) {
+    int index = t->held[i];
+    thin_slot *slot = &t->slots[index];
+    thin_type type = (16 * 128 > index) ? THIN_CC :
+      ((16 * 128 + 16 > index) ? THIN_PITCHBEND : THIN_PRESSURE);
+    uint64_t due = thin_slot_due(t, slot, type);
+
+    if ((slot->pending != slot->last) && (now < due)) {
+      /*
+       * Not yet, keep it held.
+       */
+      if ((0 == t->due) || (due < t->due)) {
+        t->due = due;
+      }
+      i++;
+      continue;
+    }
+
+    if (slot->pending != slot->last) {
+      snd_seq_event_t ev;
+      int channel = (THIN_CC == type) ? index / 128 : index % 16;
+
+      snd_seq_ev_clear(&ev);
+      ev.type = (THIN_CC == type) ? SND_SEQ_EVENT_CONTROLLER :
+        ((THIN_PITCHBEND == type) ? SND_SEQ_EVENT_PITCHBEND :
+         SND_SEQ_EVENT_CHANPRESS);
+      ev.data.control.channel = channel;
+      ev.data.control.param = (THIN_CC == type) ? index % 128 : 0;
+      ev.data.control.value = slot->pending;
+      slot->last = slot->pending;
+      slot->time = now;
+      t->sent[type]++;
+      output(&ev, arg);
+    }
+
+    slot->held = 0;
+    t->held[i] = t->held[--t->nheld];
+  }
+}
+
+
+uint64_t thin_due(const thin *t) {
+  return t->due;
+}
+
+
+void thin_counts(const thin *t,
+                 thin_type type,
+                 uint64_t *received,
+                 uint64_t *sent) {
+  *received = t->received[type];
+  *sent = t->sent[type];
+}
+
+
+void thin_delete(thin *t) {
+  free(t);
+}
@@ -0,0 +1,107 @@
+/*
+ * thin.h
+ *
+ * Copyright (C)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * About
+ * -----
+ *
+ * Author: AiO <aio at aio dot nu>
+ *
+ * Simple API for thinning out streams of continuous data, MIDI Continuous
+ * Controllers, pitch bend and channel pressure, per channel and controller.
+ * A value is held back when it comes too soon after the last one sent or
+ * differs too little from it, and only the latest held value is sent when
+ * the stream is due again, so the final value always gets through.
+ *
+ */
+
+#ifndef _THIN_H_
+#define _THIN_H_
+
+#include <stdint.h>
+#include <alsa/asoundlib.h>
+
+/*
+ * The kinds of streams that can be thinned out.
+ */
+typedef enum {
+  THIN_CC,
+  THIN_PITCHBEND,
+  THIN_PRESSURE,
+  THIN_TYPES
+} thin_type;
+
+/*
+ * How to thin out one kind of stream: at most rate values per second per
+ * stream (0 = no limit) and only values that differ at least delta from
+ * the last one sent (0 = any change). Repeated values are always dropped.
+ */
+typedef struct {
+  int rate;
+  int delta;
+} thin_policy;
+
+/*
+ * Called for every held value that is sent by thin_flush().
+ */
+typedef void (*thin_output)(snd_seq_event_t *ev, void *arg);
+
+typedef struct thin thin;
+
+
+/*
+ * Allocate a new stream thinner with one policy per kind of stream. A
+ * policy with neither a rate nor a delta leaves that kind alone.
+ */
+thin *thin_new(const thin_policy policy[THIN_TYPES]);
+
+
+/*
+ * Look at an outgoing event at time now (from timestamp_now()). Returns 1
+ * if it should be sent now, or 0 if it is dropped or held.
+ */
+int thin_event(thin *t, const snd_seq_event_t *ev, uint64_t now);
+
+
+/*
+ * Send the held values that are due at time now through output.
+ */
+void thin_flush(thin *t, uint64_t now, thin_output output, void *arg);
+
+
+/*
+ * Get the time the next held value is due, or 0 if none is held.
+ */
+uint64_t thin_due(const thin *t);
+
+
+/*
+ * Get the number of events looked at and sent so far for a kind of stream.
+ */
+void thin_counts(const thin *t,
+                 thin_type type,
+                 uint64_t *received,
+                 uint64_t *sent);
+
+
+/*
+ * Cleanup a stream thinner.
+ */
+void thin_delete(thin *t);
+
+#endif /* _THIN_H_ */
@@ -0,0 +1,61 @@
+/*
+ * timestamp.c
+ *
+ * Copyright (C)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * About
+ * -----
+ *
+ * Author: AiO <aio at aio dot nu>
+ *
+ * Simple implementation for reading a monotonic clock.
+ *
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <time.h>
+
+#include "timestamp.h"
+
+
+/*
+ * Get the current time of the monotonic clock in nanoseconds.
+ */
+uint64_t timestamp_now() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+
+/*
+ * Get the CPU time-stamp counter.
+ */
+uint64_t timestamp_cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+  uint32_t low, high;
+
+  __asm__ __volatile__("rdtsc" : "=a" (low), "=d" (high));
+
+  return ((uint64_t)high << 32) | low;
+#else
+  return 0;
+#endif
+}
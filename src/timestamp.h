@@ -0,0 +1,46 @@
+/*
+ * timestamp.h
+ *
+ * Copyright (C)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * About
+ * -----
+ *
+ * Author: AiO <aio at aio dot nu>
+ *
+ * Simple API for reading a monotonic clock and the CPU cycle counter.
+ *
+ */
+
+#ifndef _TIMESTAMP_H_
+#define _TIMESTAMP_H_
+
+#include <stdint.h>
+
+/*
+ * Get the current time of the monotonic clock in nanoseconds.
+ */
+uint64_t timestamp_now();
+
+
+/*
+ * Get the CPU time-stamp counter, for counting cycles in benchmarks.
+ * Returns 0 on CPUs where it is not available.
+ */
+uint64_t timestamp_cycles();
+
+#endif /* _TIMESTAMP_H_ */